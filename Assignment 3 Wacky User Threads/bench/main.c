@@ -0,0 +1,63 @@
+#include "wut.h"
+
+#include <stdio.h> // printf, fprintf
+#include <stdlib.h> // exit, strtol
+#include <time.h> // clock_gettime
+
+static long yields = 1000000;
+
+static void run(void) {
+    for (long i = 0; i < yields; ++i) {
+        wut_yield();
+    }
+}
+
+static long parse(const char* arg, long min) {
+    char* end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < min) {
+        fprintf(stderr, "usage: wut-bench [threads] [yields per thread]\n");
+        exit(1);
+    }
+    return value;
+}
+
+/* Every thread yields in a loop while the main thread waits in `wut_join`,
+   so each switch comes from a yield. It takes two threads for a yield to
+   have anywhere to go. */
+int main(int argc, char* argv[]) {
+    int threads = 2;
+    if (argc > 1) {
+        threads = parse(argv[1], 2);
+    }
+    if (argc > 2) {
+        yields = parse(argv[2], 1);
+    }
+
+    wut_init();
+    int* ids = malloc(threads * sizeof(int));
+    if (ids == NULL) {
+        perror("malloc failed");
+        exit(1);
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < threads; ++i) {
+        ids[i] = wut_create(run);
+    }
+    for (int i = 0; i < threads; ++i) {
+        wut_join(ids[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(ids);
+
+    double seconds = (end.tv_sec - start.tv_sec)
+                     + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double total = (double) threads * yields;
+    printf("%s: %d threads, %.0f yields in %.3f s, %.2f M yields/s, %.1f ns/yield\n",
+           WUT_CONTEXT, threads, total, seconds, total / seconds / 1e6,
+           seconds * 1e9 / total);
+    return 0;
+}
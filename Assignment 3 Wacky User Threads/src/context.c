@@ -0,0 +1,65 @@
+#include "context.h"
+
+#include <errno.h> // errno
+#include <stdint.h> // uint64_t, uintptr_t
+#include <stdio.h> // perror
+#include <stdlib.h> // exit
+
+#ifdef WUT_UCONTEXT
+
+static void die(const char* message) {
+    int err = errno;
+    perror(message);
+    exit(err);
+}
+
+void context_init(struct context* context, char* stack, size_t size,
+                  void (*entry)(void)) {
+    if (getcontext(&context->ucontext) == -1) {
+        die("getcontext failed");
+    }
+    context->ucontext.uc_stack.ss_sp = stack;
+    context->ucontext.uc_stack.ss_size = size;
+    context->ucontext.uc_link = NULL;
+    makecontext(&context->ucontext, entry, 0);
+}
+
+// This also saves and restores the signal mask, which costs a system call
+// on every switch.
+void context_switch(struct context* from, struct context* to) {
+    if (swapcontext(&from->ucontext, &to->ucontext) == -1) {
+        die("swapcontext failed");
+    }
+}
+
+#else
+
+// Builds the frame `context_switch` would have left behind, so its `ret`
+// lands on `entry` with the stack aligned as if `entry` had been called.
+void context_init(struct context* context, char* stack, size_t size,
+                  void (*entry)(void)) {
+    uint64_t* top = (uint64_t*) ((uintptr_t) (stack + size) & ~(uintptr_t) 15);
+#if defined(__x86_64__)
+    // MXCSR and the x87 control word, then r15, r14, r13, r12, rbx, rbp,
+    // the return address, and a fake return address for `entry`.
+    uint64_t* frame = top - 9;
+    frame[0] = 0x1F80 | (UINT64_C(0x037F) << 32);
+    for (int i = 1; i <= 6; ++i) {
+        frame[i] = 0;
+    }
+    frame[7] = (uintptr_t) entry;
+    frame[8] = 0;
+#elif defined(__aarch64__)
+    // x19 to x30, then d8 to d15, `ret` jumps to x30.
+    uint64_t* frame = top - 20;
+    for (int i = 0; i < 20; ++i) {
+        frame[i] = 0;
+    }
+    frame[11] = (uintptr_t) entry;
+#else
+#error "no assembly context switch for this CPU, build with -Dcontext=ucontext"
+#endif
+    context->sp = frame;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stddef.h> // size_t
+
+#ifdef WUT_UCONTEXT
+#include <ucontext.h> // ucontext_t
+
+struct context {
+    ucontext_t ucontext;
+};
+#else
+// Everything else is saved on the thread's own stack, the assembly in
+// context-<cpu>.S expects `sp` to be the first member.
+struct context {
+    void* sp;
+};
+#endif
+
+// Sets up `context` so switching to it calls `entry` on `stack`, `entry`
+// must never return.
+void context_init(struct context* context, char* stack, size_t size,
+                  void (*entry)(void));
+// Saves the running thread into `from` and resumes `to`.
+void context_switch(struct context* from, struct context* to);
+
+#endif
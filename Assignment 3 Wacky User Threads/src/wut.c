@@ -1,14 +1,16 @@
 #include "wut.h"
 
+#include "context.h"
+
 #include <assert.h> // assert
 #include <errno.h> // errno
+#include <stdbool.h> // bool
 #include <stddef.h> // NULL
 #include <stdio.h> // perror
 #include <stdlib.h> // reallocarray
 #include <sys/mman.h> // mmap, munmap
 #include <sys/signal.h> // SIGSTKSZ
 #include <sys/queue.h> // TAILQ_*
-#include <ucontext.h> // getcontext, makecontext, setcontext, swapcontext
 #include <valgrind/valgrind.h> // VALGRIND_STACK_REGISTER
 
 static void die(const char* message) {
@@ -39,28 +41,234 @@ static void delete_stack(char* stack) {
     }
 }
 
+enum thread_state {
+    THREAD_UNUSED,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_TERMINATED,
+};
+
+// Control blocks are allocated once per id and reused, a ucontext_t points
+// into itself so the context can't be moved by growing the table.
+struct thread {
+    int id;
+    enum thread_state state;
+    int status;
+    void (*run)(void);
+    char* stack;
+    // The thread blocked in `wut_join` on us, and the one we're joining.
+    struct thread* joiner;
+    struct thread* joining;
+    struct context context;
+    TAILQ_ENTRY(thread) ready_entry;
+};
+
+TAILQ_HEAD(ready_queue, thread);
+
+static struct thread** threads = NULL;
+static int thread_count = 0;
+static int thread_capacity = 0;
+
+// Ids of threads that were joined, kept as a min-heap so the lowest one is
+// reused first.
+static int* free_ids = NULL;
+static int free_id_count = 0;
+static int free_id_capacity = 0;
+
+static struct ready_queue ready_queue = TAILQ_HEAD_INITIALIZER(ready_queue);
+static struct thread* current = NULL;
+
+static void* grow(void* array, int* capacity, size_t size) {
+    int new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+    array = reallocarray(array, new_capacity, size);
+    if (array == NULL) {
+        die("reallocarray failed");
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+static void push_free_id(int id) {
+    if (free_id_count == free_id_capacity) {
+        free_ids = grow(free_ids, &free_id_capacity, sizeof(int));
+    }
+    int i = free_id_count++;
+    while (i > 0 && free_ids[(i - 1) / 2] > id) {
+        free_ids[i] = free_ids[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    free_ids[i] = id;
+}
+
+static int pop_free_id(void) {
+    int id = free_ids[0];
+    int last = free_ids[--free_id_count];
+    int i = 0;
+    while (2 * i + 1 < free_id_count) {
+        int child = 2 * i + 1;
+        if (child + 1 < free_id_count && free_ids[child + 1] < free_ids[child]) {
+            ++child;
+        }
+        if (last <= free_ids[child]) {
+            break;
+        }
+        free_ids[i] = free_ids[child];
+        i = child;
+    }
+    free_ids[i] = last;
+    return id;
+}
+
+static struct thread* new_thread(void) {
+    if (free_id_count > 0) {
+        return threads[pop_free_id()];
+    }
+    if (thread_count == thread_capacity) {
+        threads = grow(threads, &thread_capacity, sizeof(struct thread*));
+    }
+    struct thread* thread = calloc(1, sizeof(struct thread));
+    if (thread == NULL) {
+        die("calloc thread failed");
+    }
+    thread->id = thread_count;
+    threads[thread_count++] = thread;
+    return thread;
+}
+
+static struct thread* get_thread(int id) {
+    if (id < 0 || id >= thread_count) {
+        return NULL;
+    }
+    struct thread* thread = threads[id];
+    if (thread->state == THREAD_UNUSED) {
+        return NULL;
+    }
+    return thread;
+}
+
+static void make_ready(struct thread* thread) {
+    thread->state = THREAD_READY;
+    TAILQ_INSERT_TAIL(&ready_queue, thread, ready_entry);
+}
+
+static struct thread* next_ready(void) {
+    struct thread* next = TAILQ_FIRST(&ready_queue);
+    if (next != NULL) {
+        TAILQ_REMOVE(&ready_queue, next, ready_entry);
+    }
+    return next;
+}
+
+// The caller has already put `current` wherever it belongs.
+static void switch_to(struct thread* next) {
+    struct thread* previous = current;
+    current = next;
+    next->state = THREAD_RUNNING;
+    context_switch(&previous->context, &next->context);
+}
+
+static void terminate(struct thread* thread, int status) {
+    thread->state = THREAD_TERMINATED;
+    thread->status = status;
+    if (thread->joiner != NULL) {
+        make_ready(thread->joiner);
+    }
+}
+
+// Only a joiner frees a thread, so the stack is never the one we're on.
+static int reap(struct thread* thread) {
+    int status = thread->status;
+    if (thread->stack != NULL) {
+        delete_stack(thread->stack);
+        thread->stack = NULL;
+    }
+    thread->state = THREAD_UNUSED;
+    thread->joiner = NULL;
+    push_free_id(thread->id);
+    return status;
+}
+
+static void thread_start(void) {
+    current->run();
+    wut_exit(0);
+}
+
 void wut_init() {
+    struct thread* thread = new_thread();
+    thread->state = THREAD_RUNNING;
+    current = thread;
 }
 
 int wut_id() {
-    return -1;
+    return current->id;
 }
 
 int wut_create(void (*run)(void)) {
-    return -1;
+    struct thread* thread = new_thread();
+    thread->run = run;
+    thread->status = 0;
+    thread->joiner = NULL;
+    thread->joining = NULL;
+    thread->stack = new_stack();
+    context_init(&thread->context, thread->stack, SIGSTKSZ, thread_start);
+    make_ready(thread);
+    return thread->id;
 }
 
 int wut_cancel(int id) {
-    return -1;
+    struct thread* thread = get_thread(id);
+    if (thread == NULL || thread == current
+        || thread->state == THREAD_TERMINATED) {
+        return -1;
+    }
+    if (thread->state == THREAD_READY) {
+        TAILQ_REMOVE(&ready_queue, thread, ready_entry);
+    }
+    else if (thread->state == THREAD_BLOCKED) {
+        thread->joining->joiner = NULL;
+        thread->joining = NULL;
+    }
+    terminate(thread, 128);
+    return 0;
 }
 
 int wut_join(int id) {
-    return -1;
+    struct thread* thread = get_thread(id);
+    if (thread == NULL || thread == current || thread->joiner != NULL) {
+        return -1;
+    }
+    if (thread->state != THREAD_TERMINATED) {
+        // Nothing could ever wake us up.
+        struct thread* next = next_ready();
+        if (next == NULL) {
+            return -1;
+        }
+        thread->joiner = current;
+        current->joining = thread;
+        current->state = THREAD_BLOCKED;
+        switch_to(next);
+        current->joining = NULL;
+    }
+    return reap(thread);
 }
 
 int wut_yield() {
-    return -1;
+    struct thread* next = next_ready();
+    if (next == NULL) {
+        return -1;
+    }
+    make_ready(current);
+    switch_to(next);
+    return 0;
 }
 
 void wut_exit(int status) {
+    terminate(current, status & 0xFF);
+    struct thread* next = next_ready();
+    if (next == NULL) {
+        exit(0);
+    }
+    switch_to(next);
+    assert(false);
 }
@@ -0,0 +1,158 @@
+#include "bench.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t bench_nsec_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* Uses the nearest-rank method, so the result is always one of the
+   samples. */
+uint64_t bench_percentile(uint64_t *samples, size_t count, double percentile)
+{
+	assert(count > 0);
+	qsort(samples, count, sizeof(uint64_t), compare_samples);
+	size_t rank = (size_t) ceil(percentile / 100 * count);
+	if (rank == 0) {
+		rank = 1;
+	}
+	if (rank > count) {
+		rank = count;
+	}
+	return samples[rank - 1];
+}
+
+void bench_result_compute(struct bench_result *result,
+                          uint64_t *samples,
+                          size_t count,
+                          uint64_t operations)
+{
+	assert(count > 0);
+	qsort(samples, count, sizeof(uint64_t), compare_samples);
+
+	double median;
+	if (count % 2 == 1) {
+		median = samples[count / 2];
+	}
+	else {
+		median = (samples[count / 2 - 1] + samples[count / 2]) / 2.0;
+	}
+
+	double sum = 0;
+	for (size_t i = 0; i < count; ++i) {
+		sum += samples[i];
+	}
+	double mean = sum / count;
+	double squares = 0;
+	for (size_t i = 0; i < count; ++i) {
+		double difference = samples[i] - mean;
+		squares += difference * difference;
+	}
+	/* The sample standard deviation, we only have a few repetitions */
+	double stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+
+	result->repetitions = count;
+	result->median_usec = median / 1000;
+	result->p99_usec = bench_percentile(samples, count, 99) / 1000.0;
+	result->mean_usec = mean / 1000;
+	result->stddev_usec = stddev / 1000;
+	result->min_usec = samples[0] / 1000.0;
+	result->max_usec = samples[count - 1] / 1000.0;
+	result->ops_per_sec = median > 0 ? operations / (median / 1e9) : 0;
+}
+
+bool bench_format_parse(const char *name, enum bench_format *format)
+{
+	if (strcmp(name, "text") == 0) {
+		*format = BENCH_FORMAT_TEXT;
+	}
+	else if (strcmp(name, "csv") == 0) {
+		*format = BENCH_FORMAT_CSV;
+	}
+	else if (strcmp(name, "json") == 0) {
+		*format = BENCH_FORMAT_JSON;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+static void print_text(FILE *file, const struct bench_result *result)
+{
+	fprintf(file, "%s (%u threads, %u per thread, %zu repetitions):\n",
+	        result->name, result->threads, result->size, result->repetitions);
+	fprintf(file, "  - median %.1f usec, p99 %.1f usec\n",
+	        result->median_usec, result->p99_usec);
+	fprintf(file, "  - mean %.1f usec, stddev %.1f usec, min %.1f usec, max %.1f usec\n",
+	        result->mean_usec, result->stddev_usec, result->min_usec, result->max_usec);
+	fprintf(file, "  - %.0f ops/sec\n", result->ops_per_sec);
+}
+
+/* Table names are ours and never contain quotes, commas or backslashes, so
+   they don't need escaping in either format. */
+static void print_csv(FILE *file, const struct bench_result *result)
+{
+	fprintf(file, "%s,%u,%u,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.0f\n",
+	        result->name, result->threads, result->size, result->repetitions,
+	        result->median_usec, result->p99_usec, result->mean_usec,
+	        result->stddev_usec, result->min_usec, result->max_usec,
+	        result->ops_per_sec);
+}
+
+static void print_json(FILE *file, const struct bench_result *result)
+{
+	fprintf(file,
+	        "{\"table\": \"%s\", \"threads\": %u, \"size\": %u, "
+	        "\"repetitions\": %zu, \"median_usec\": %.3f, \"p99_usec\": %.3f, "
+	        "\"mean_usec\": %.3f, \"stddev_usec\": %.3f, \"min_usec\": %.3f, "
+	        "\"max_usec\": %.3f, \"ops_per_sec\": %.0f}",
+	        result->name, result->threads, result->size, result->repetitions,
+	        result->median_usec, result->p99_usec, result->mean_usec,
+	        result->stddev_usec, result->min_usec, result->max_usec,
+	        result->ops_per_sec);
+}
+
+void bench_print(FILE *file,
+                 enum bench_format format,
+                 const struct bench_result *results,
+                 size_t count)
+{
+	switch (format) {
+	case BENCH_FORMAT_TEXT:
+		for (size_t i = 0; i < count; ++i) {
+			print_text(file, &results[i]);
+		}
+		break;
+	case BENCH_FORMAT_CSV:
+		fprintf(file, "table,threads,size,repetitions,median_usec,p99_usec,"
+		              "mean_usec,stddev_usec,min_usec,max_usec,ops_per_sec\n");
+		for (size_t i = 0; i < count; ++i) {
+			print_csv(file, &results[i]);
+		}
+		break;
+	case BENCH_FORMAT_JSON:
+		fprintf(file, "[\n");
+		for (size_t i = 0; i < count; ++i) {
+			fprintf(file, "  ");
+			print_json(file, &results[i]);
+			fprintf(file, "%s\n", i + 1 < count ? "," : "");
+		}
+		fprintf(file, "]\n");
+		break;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum bench_format {
+	BENCH_FORMAT_TEXT,
+	BENCH_FORMAT_CSV,
+	BENCH_FORMAT_JSON,
+};
+
+/* The summary of timing the same run several times. */
+struct bench_result {
+	const char *name;
+	uint32_t threads;
+	uint32_t size;
+	size_t repetitions;
+	double median_usec;
+	double p99_usec;
+	double mean_usec;
+	double stddev_usec;
+	double min_usec;
+	double max_usec;
+	/* Operations per second at the median time. */
+	double ops_per_sec;
+};
+
+/* Returns the time from a monotonic clock, which unlike `gettimeofday` never
+   jumps when the system clock is adjusted. */
+uint64_t bench_nsec_now(void);
+
+/* Sorts `samples` and returns the smallest sample that at least `percentile`
+   percent of the samples are less than or equal to. */
+uint64_t bench_percentile(uint64_t *samples, size_t count, double percentile);
+
+/* Fills in the statistics of `result` from the time of every repetition in
+   nanoseconds, each of which did `operations` operations. This sorts
+   `samples`. */
+void bench_result_compute(struct bench_result *result,
+                          uint64_t *samples,
+                          size_t count,
+                          uint64_t operations);
+
+/* Returns false if `name` isn't text, csv or json. */
+bool bench_format_parse(const char *name, enum bench_format *format);
+
+void bench_print(FILE *file,
+                 enum bench_format format,
+                 const struct bench_result *results,
+                 size_t count);
@@ -0,0 +1,108 @@
+#include "bucket-lock.h"
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* How many times we check the lock before going to sleep, and the most
+   pause instructions between two checks. */
+#define SPIN_LIMIT 100
+#define MAX_BACKOFF 64
+
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+static uint64_t nsec_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* The lock is only ever used within one process. */
+static void futex_wait(_Atomic uint32_t *address, uint32_t expected)
+{
+	syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *address)
+{
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void bucket_lock_init(struct bucket_lock *lock, bool timed)
+{
+	atomic_init(&lock->state, 0);
+	lock->timed = timed;
+	lock->locked_at = 0;
+	memset(&lock->stats, 0, sizeof(struct bucket_lock_stats));
+}
+
+static bool try_lock(struct bucket_lock *lock)
+{
+	uint32_t expected = 0;
+	return atomic_compare_exchange_weak_explicit(&lock->state, &expected, 1,
+	                                             memory_order_acquire,
+	                                             memory_order_relaxed);
+}
+
+/* The futex part is the classic one from Drepper's "Futexes Are Tricky". A
+   thread that wakes up can't tell whether others are still asleep, so it
+   takes the lock as 2 and the next unlock wakes someone up. */
+void bucket_lock_lock(struct bucket_lock *lock)
+{
+	uint64_t spins = 0;
+	uint64_t parks = 0;
+	bool contended = !try_lock(lock);
+	if (contended) {
+		bool locked = false;
+		uint32_t backoff = 1;
+		while (spins < SPIN_LIMIT && !locked) {
+			for (uint32_t i = 0; i < backoff; ++i) {
+				cpu_relax();
+			}
+			if (backoff < MAX_BACKOFF) {
+				backoff *= 2;
+			}
+			++spins;
+			/* Only try the atomic once the lock looks free, so spinning
+			   doesn't keep stealing the cache line from the holder */
+			locked = atomic_load_explicit(&lock->state, memory_order_relaxed) == 0
+			         && try_lock(lock);
+		}
+		if (!locked) {
+			while (atomic_exchange_explicit(&lock->state, 2,
+			                                memory_order_acquire) != 0) {
+				futex_wait(&lock->state, 2);
+				++parks;
+			}
+		}
+	}
+
+	lock->stats.acquisitions += 1;
+	lock->stats.contended += contended;
+	lock->stats.spins += spins;
+	lock->stats.parks += parks;
+	if (lock->timed) {
+		lock->locked_at = nsec_now();
+	}
+}
+
+void bucket_lock_unlock(struct bucket_lock *lock)
+{
+	if (lock->timed) {
+		lock->stats.hold_nsec += nsec_now() - lock->locked_at;
+	}
+	if (atomic_exchange_explicit(&lock->state, 0, memory_order_release) == 2) {
+		futex_wake(&lock->state);
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* What happened to a lock since it was initialized. Only the thread that
+   holds the lock updates them, so they need no atomics of their own. */
+struct bucket_lock_stats {
+	uint64_t acquisitions;
+	/* Acquisitions that found the lock taken. */
+	uint64_t contended;
+	/* Times we checked the lock again while spinning. */
+	uint64_t spins;
+	/* Times we went to sleep in the kernel. */
+	uint64_t parks;
+	/* Only counted by locks initialized with `timed`. */
+	uint64_t hold_nsec;
+};
+
+/* A lock for critical sections that are only a few hundred cycles long. A
+   thread that finds it taken spins for a while, backing off exponentially
+   with the CPU's pause hint in between, since the holder is likely to be
+   done soon. Only if it isn't does the thread sleep on a futex, like
+   `pthread_mutex_lock` would right away. */
+struct bucket_lock {
+	/* 0 unlocked, 1 locked, 2 locked with threads (maybe) asleep. */
+	_Atomic uint32_t state;
+	bool timed;
+	uint64_t locked_at;
+	struct bucket_lock_stats stats;
+};
+
+/* Unless `timed`, the lock doesn't read the clock and `hold_nsec` stays 0. */
+void bucket_lock_init(struct bucket_lock *lock, bool timed);
+void bucket_lock_lock(struct bucket_lock *lock);
+void bucket_lock_unlock(struct bucket_lock *lock);
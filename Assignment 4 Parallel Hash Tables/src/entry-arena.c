@@ -0,0 +1,161 @@
+#include "entry-arena.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_SIZE (64 * 1024)
+
+/* A thread keeps up to this many freed objects for itself, past that they
+   go to the arena for any thread to reuse. */
+#define LOCAL_FREE_OBJECTS 256
+
+struct slab {
+	struct slab *next;
+	/* Keeps the objects after the header aligned for any type. */
+	alignas(max_align_t) char objects[];
+};
+
+/* Freed objects are kept in a list threaded through their first bytes. */
+struct free_object {
+	struct free_object *next;
+};
+
+/* Where one thread is in one arena. Only that thread touches it, it gets a
+   cache line of its own so threads carving from the same arena don't share
+   one. */
+struct entry_arena_cursor {
+	alignas(64) char *next;
+	char *end;
+	struct free_object *free_objects;
+	struct free_object *free_tail;
+	size_t free_count;
+};
+
+void entry_arena_init(struct entry_arena *arena, size_t object_size)
+{
+	size_t alignment = alignof(max_align_t);
+	arena->object_size = (object_size + alignment - 1) / alignment * alignment;
+	assert(arena->object_size <= SLAB_SIZE - sizeof(struct slab));
+	pthread_mutex_init(&arena->mutex, NULL);
+	arena->slabs = NULL;
+	arena->slab_count = 0;
+	arena->free_objects = NULL;
+	/* A zeroed cursor has no slab and no free objects. */
+	thread_slot_array_init(&arena->cursors, sizeof(struct entry_arena_cursor),
+	                       alignof(struct entry_arena_cursor));
+}
+
+static struct entry_arena_cursor *get_cursor(struct entry_arena *arena)
+{
+	return thread_slot_array_get(&arena->cursors, thread_slot_get());
+}
+
+/* This is the only time we lock the arena, once per `SLAB_SIZE` bytes or
+   per batch of objects. We take some of what other threads gave back
+   before we start a new slab. */
+static void refill(struct entry_arena *arena, struct entry_arena_cursor *cursor)
+{
+	pthread_mutex_lock(&arena->mutex);
+	if (arena->free_objects != NULL) {
+		struct free_object *first = arena->free_objects;
+		struct free_object *last = first;
+		size_t count = 1;
+		while (count < LOCAL_FREE_OBJECTS / 2 && last->next != NULL) {
+			last = last->next;
+			++count;
+		}
+		arena->free_objects = last->next;
+		pthread_mutex_unlock(&arena->mutex);
+		last->next = NULL;
+		cursor->free_objects = first;
+		cursor->free_tail = last;
+		cursor->free_count = count;
+		return;
+	}
+	pthread_mutex_unlock(&arena->mutex);
+
+	struct slab *slab = calloc(1, SLAB_SIZE);
+	assert(slab != NULL);
+
+	pthread_mutex_lock(&arena->mutex);
+	slab->next = arena->slabs;
+	arena->slabs = slab;
+	++arena->slab_count;
+	pthread_mutex_unlock(&arena->mutex);
+
+	cursor->next = slab->objects;
+	cursor->end = (char *) slab + SLAB_SIZE;
+}
+
+static void *pop_free_object(struct entry_arena *arena,
+                             struct entry_arena_cursor *cursor)
+{
+	struct free_object *object = cursor->free_objects;
+	cursor->free_objects = object->next;
+	--cursor->free_count;
+	memset(object, 0, arena->object_size);
+	return object;
+}
+
+void *entry_arena_alloc(struct entry_arena *arena)
+{
+	struct entry_arena_cursor *cursor = get_cursor(arena);
+	if (cursor->free_objects != NULL) {
+		return pop_free_object(arena, cursor);
+	}
+	if ((size_t) (cursor->end - cursor->next) < arena->object_size) {
+		refill(arena, cursor);
+		if (cursor->free_objects != NULL) {
+			return pop_free_object(arena, cursor);
+		}
+	}
+	void *object = cursor->next;
+	cursor->next += arena->object_size;
+	return object;
+}
+
+/* A thread that only frees, like one that removes what others inserted,
+   hands its objects to the arena in batches so they aren't stranded. */
+void entry_arena_free(struct entry_arena *arena, void *object)
+{
+	struct entry_arena_cursor *cursor = get_cursor(arena);
+	struct free_object *free_object = object;
+	free_object->next = cursor->free_objects;
+	cursor->free_objects = free_object;
+	if (cursor->free_count++ == 0) {
+		cursor->free_tail = free_object;
+	}
+	if (cursor->free_count < LOCAL_FREE_OBJECTS) {
+		return;
+	}
+
+	pthread_mutex_lock(&arena->mutex);
+	cursor->free_tail->next = arena->free_objects;
+	arena->free_objects = cursor->free_objects;
+	pthread_mutex_unlock(&arena->mutex);
+	cursor->free_objects = NULL;
+	cursor->free_tail = NULL;
+	cursor->free_count = 0;
+}
+
+size_t entry_arena_bytes(struct entry_arena *arena)
+{
+	pthread_mutex_lock(&arena->mutex);
+	size_t bytes = arena->slab_count * SLAB_SIZE;
+	pthread_mutex_unlock(&arena->mutex);
+	return bytes;
+}
+
+void entry_arena_destroy(struct entry_arena *arena)
+{
+	while (arena->slabs != NULL) {
+		struct slab *slab = arena->slabs;
+		arena->slabs = slab->next;
+		free(slab);
+	}
+	thread_slot_array_destroy(&arena->cursors);
+	pthread_mutex_destroy(&arena->mutex);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "thread-slot.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct slab;
+struct free_object;
+struct entry_arena_cursor;
+
+/* An arena hands out fixed-size objects (our `list_entry`s) carved out of
+   large slabs instead of calling `calloc` for every one of them. Each thread
+   carves objects from a slab of its own, so allocating doesn't take a lock
+   except to grab a new slab. A thread keeps its place in every arena it
+   uses, so going back and forth between many tables doesn't waste slabs.
+   The memory always goes back to the system all at once in
+   `entry_arena_destroy`. Objects given to `entry_arena_free` are reused by
+   the same thread first, a thread that frees a lot passes them on to the
+   arena for everyone. */
+struct entry_arena {
+	size_t object_size;
+	pthread_mutex_t mutex;
+	struct slab *slabs;
+	size_t slab_count;
+	/* Objects threads freed more of than they kept, protected by `mutex`. */
+	struct free_object *free_objects;
+	/* Every thread's `entry_arena_cursor`, indexed by `thread_slot_get`. A
+	   thread that gets a slot back picks up where the last one left off. */
+	struct thread_slot_array cursors;
+};
+
+void entry_arena_init(struct entry_arena *arena, size_t object_size);
+/* Returns a zero initialized object of the arena's `object_size`. */
+void *entry_arena_alloc(struct entry_arena *arena);
+/* Gives the object back for a later allocation, from any thread. */
+void entry_arena_free(struct entry_arena *arena, void *object);
+/* Returns how many bytes of slabs the arena has allocated. */
+size_t entry_arena_bytes(struct entry_arena *arena);
+void entry_arena_destroy(struct entry_arena *arena);
@@ -0,0 +1,130 @@
+#include "epoch.h"
+
+#include "thread-slot.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* A thread tries to advance the global epoch every time it retires this
+   many objects. */
+#define ADVANCE_INTERVAL 64
+
+void epoch_domain_init(struct epoch_domain *domain,
+                       epoch_reclaim_function *reclaim,
+                       void *context)
+{
+	atomic_init(&domain->epoch, 0);
+	domain->reclaim = reclaim;
+	domain->context = context;
+	/* A zeroed slot is a thread that isn't reading and has nothing in
+	   limbo. */
+	thread_slot_array_init(&domain->slots, sizeof(struct epoch_slot),
+	                       alignof(struct epoch_slot));
+}
+
+static struct epoch_slot *get_slot(struct epoch_domain *domain)
+{
+	return thread_slot_array_get(&domain->slots, thread_slot_get());
+}
+
+/* The fence orders our announcement before any reads of the shared
+   structure. Once a writer advancing the epoch can see it, it won't advance
+   past the epoch we saw. If it read our slot just before we stored to it,
+   the object it's about to reclaim was already unlinked, and our reads come
+   after that. */
+void epoch_enter(struct epoch_domain *domain)
+{
+	struct epoch_slot *slot = get_slot(domain);
+	if (slot->depth++ > 0) {
+		return;
+	}
+	uint64_t epoch = atomic_load_explicit(&domain->epoch, memory_order_relaxed);
+	atomic_store_explicit(&slot->state, (epoch << 1) | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit(struct epoch_domain *domain)
+{
+	struct epoch_slot *slot = get_slot(domain);
+	assert(slot->depth > 0);
+	if (--slot->depth > 0) {
+		return;
+	}
+	atomic_store_explicit(&slot->state, 0, memory_order_release);
+}
+
+static void reclaim_limbo(struct epoch_domain *domain, struct epoch_limbo *limbo)
+{
+	for (size_t i = 0; i < limbo->count; ++i) {
+		domain->reclaim(limbo->objects[i], domain->context);
+	}
+	limbo->count = 0;
+}
+
+/* The epoch can only move forward once every thread that's reading has seen
+   the current one. A thread whose slot we don't find yet is like one whose
+   announcement we read just before it stored it. */
+static void try_advance(struct epoch_domain *domain, uint64_t epoch)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	size_t count = thread_slot_count();
+	for (size_t i = 0; i < count; ++i) {
+		struct epoch_slot *slot = thread_slot_array_find(&domain->slots, i);
+		if (slot == NULL) {
+			continue;
+		}
+		uint64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+		if ((state & 1) && (state >> 1) != epoch) {
+			return;
+		}
+	}
+	atomic_compare_exchange_strong(&domain->epoch, &epoch, epoch + 1);
+}
+
+/* An object retired while the epoch was `e` can be reclaimed once the epoch
+   reaches `e + 2`, every reader that could still see it has exited by then.
+   We keep one list for each of the last three epochs. */
+void epoch_retire(struct epoch_domain *domain, void *object)
+{
+	struct epoch_slot *slot = get_slot(domain);
+	uint64_t epoch = atomic_load_explicit(&domain->epoch, memory_order_seq_cst);
+
+	for (size_t i = 0; i < 3; ++i) {
+		struct epoch_limbo *limbo = &slot->limbo[i];
+		if (limbo->count > 0 && limbo->epoch + 2 <= epoch) {
+			reclaim_limbo(domain, limbo);
+		}
+	}
+
+	struct epoch_limbo *limbo = &slot->limbo[epoch % 3];
+	limbo->epoch = epoch;
+	if (limbo->count == limbo->capacity) {
+		limbo->capacity = limbo->capacity == 0 ? 64 : limbo->capacity * 2;
+		limbo->objects = realloc(limbo->objects, limbo->capacity * sizeof(void *));
+		assert(limbo->objects != NULL);
+	}
+	limbo->objects[limbo->count++] = object;
+
+	if (++slot->retired % ADVANCE_INTERVAL == 0) {
+		try_advance(domain, epoch);
+	}
+}
+
+void epoch_domain_destroy(struct epoch_domain *domain)
+{
+	size_t count = thread_slot_count();
+	for (size_t i = 0; i < count; ++i) {
+		struct epoch_slot *slot = thread_slot_array_find(&domain->slots, i);
+		if (slot == NULL) {
+			continue;
+		}
+		assert(atomic_load(&slot->state) == 0);
+		for (size_t j = 0; j < 3; ++j) {
+			reclaim_limbo(domain, &slot->limbo[j]);
+			free(slot->limbo[j].objects);
+		}
+	}
+	thread_slot_array_destroy(&domain->slots);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "thread-slot.h"
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void epoch_reclaim_function(void *object, void *context);
+
+/* The objects a thread retired during one epoch. */
+struct epoch_limbo {
+	uint64_t epoch;
+	void **objects;
+	size_t count;
+	size_t capacity;
+};
+
+struct epoch_slot {
+	/* 0 while the thread isn't reading, otherwise the epoch it saw when it
+	   started, shifted left with the bottom bit set. */
+	_Atomic uint64_t state;
+	/* How many `epoch_enter`s haven't been matched by an `epoch_exit` yet,
+	   only the outermost pair announces anything. */
+	uint32_t depth;
+	struct epoch_limbo limbo[3];
+	size_t retired;
+} __attribute__((aligned(64)));
+
+/* Epoch based reclamation, so readers that take no locks never touch memory
+   that was freed under them. Readers wrap every access to shared objects in
+   `epoch_enter`/`epoch_exit`, which may nest. A writer first unlinks an object, so no new
+   reader can find it, and then passes it to `epoch_retire`. The object is
+   only handed to `reclaim` once every reader that was active when it was
+   retired is done. */
+struct epoch_domain {
+	alignas(64) _Atomic uint64_t epoch;
+	epoch_reclaim_function *reclaim;
+	void *context;
+	/* Every thread uses the `epoch_slot` for its `thread_slot_get` number.
+	   Objects a thread left in limbo stay with the slot, and whoever gets
+	   the slot next will reclaim them. */
+	struct thread_slot_array slots;
+};
+
+void epoch_domain_init(struct epoch_domain *domain,
+                       epoch_reclaim_function *reclaim,
+                       void *context);
+void epoch_enter(struct epoch_domain *domain);
+void epoch_exit(struct epoch_domain *domain);
+void epoch_retire(struct epoch_domain *domain, void *object);
+/* Reclaims everything that is still retired, there can't be any readers
+   left at this point. */
+void epoch_domain_destroy(struct epoch_domain *domain);
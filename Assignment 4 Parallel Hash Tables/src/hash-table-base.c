@@ -131,6 +131,89 @@ uint32_t hash_table_base_get_value(struct hash_table_base *hash_table,
 	return list_entry->value;
 }
 
+/* The base hash table isn't used from multiple threads, so this is just a
+   lookup followed by a compare. */
+bool hash_table_base_compare_exchange(struct hash_table_base *hash_table,
+                                      const char *key,
+                                      uint32_t expected,
+                                      uint32_t desired)
+{
+	struct list_head *list_head = get_list_head(hash_table, key);
+	struct list_entry *list_entry = get_list_entry(list_head, key);
+	if (list_entry == NULL || list_entry->value != expected) {
+		return false;
+	}
+	list_entry->value = desired;
+	return true;
+}
+
+/* We find the entry the same way as every other function, then `SLIST_REMOVE`
+   walks the list again to find the node before it and unlinks it. Since no
+   other thread can be looking at the entry, we can free it right away. */
+bool hash_table_base_remove(struct hash_table_base *hash_table,
+                            const char *key)
+{
+	struct list_head *list_head = get_list_head(hash_table, key);
+	struct list_entry *list_entry = get_list_entry(list_head, key);
+	if (list_entry == NULL) {
+		return false;
+	}
+	SLIST_REMOVE(list_head, list_entry, list_entry, pointers);
+	free(list_entry);
+	return true;
+}
+
+/* This is `hash_table_base_add_entry` and `hash_table_base_get_value` in one,
+   we only have to look for the key once. */
+uint32_t hash_table_base_fetch_add(struct hash_table_base *hash_table,
+                                   const char *key,
+                                   uint32_t delta)
+{
+	struct list_head *list_head = get_list_head(hash_table, key);
+	struct list_entry *list_entry = get_list_entry(list_head, key);
+	if (list_entry != NULL) {
+		uint32_t value = list_entry->value;
+		list_entry->value += delta;
+		return value;
+	}
+
+	list_entry = calloc(1, sizeof(struct list_entry));
+	assert(list_entry != NULL);
+	list_entry->key = key;
+	list_entry->value = delta;
+	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+	return 0;
+}
+
+/* The iterator remembers which bucket it's in and the next entry in that
+   bucket's list. When it runs off the end of a list it moves on to the
+   next bucket that isn't empty. */
+void hash_table_base_iterator_begin(struct hash_table_base_iterator *iterator,
+                                    struct hash_table_base *hash_table)
+{
+	iterator->hash_table = hash_table;
+	iterator->bucket = 0;
+	iterator->next = SLIST_FIRST(&hash_table->entries[0].list_head);
+}
+
+bool hash_table_base_iterator_next(struct hash_table_base_iterator *iterator,
+                                   const char **key,
+                                   uint32_t *value)
+{
+	struct hash_table_base *hash_table = iterator->hash_table;
+	while (iterator->next == NULL) {
+		if (++iterator->bucket == HASH_TABLE_CAPACITY) {
+			return false;
+		}
+		iterator->next = SLIST_FIRST(&hash_table->entries[iterator->bucket].list_head);
+	}
+	struct list_entry *list_entry = iterator->next;
+	iterator->next = SLIST_NEXT(list_entry, pointers);
+	*key = list_entry->key;
+	*value = list_entry->value;
+	return true;
+}
+
 /* This function uses frees all memory our hash table uses. First it goes
    through the linked lists for every element. To properly free all the memory
    we free each node in the linked list, by remove removing the first node
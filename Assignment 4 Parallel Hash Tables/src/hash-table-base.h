@@ -3,6 +3,7 @@
 #include "hash-table-common.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Forward declaration of our hash table, so we can hide the implementation
    and define the struct in `hash-table-base.c`. */
@@ -24,6 +25,39 @@ bool hash_table_base_contains(struct hash_table_base *hash_table,
    not in the table this function will terminate the process. */
 uint32_t hash_table_base_get_value(struct hash_table_base *hash_table,
                                    const char* key);
+/* Sets the value for the specified key to `desired`, but only if its value
+   is currently `expected`. Returns whether the value was changed, which it
+   won't be if the key isn't in the hash table. */
+bool hash_table_base_compare_exchange(struct hash_table_base *hash_table,
+                                      const char *key,
+                                      uint32_t expected,
+                                      uint32_t desired);
+/* Removes the key (and its value) from the hash table. Returns whether the
+   key was in the hash table. */
+bool hash_table_base_remove(struct hash_table_base *hash_table,
+                            const char *key);
+/* Adds `delta` to the value of the key and returns the value it had before.
+   If the key isn't in the hash table yet, it's added with the value `delta`
+   and this returns 0. */
+uint32_t hash_table_base_fetch_add(struct hash_table_base *hash_table,
+                                   const char *key,
+                                   uint32_t delta);
+
+/* Goes through every (key, value) in the hash table, one bucket after the
+   other. The hash table can't change until you're done with the iterator. */
+struct hash_table_base_iterator {
+	struct hash_table_base *hash_table;
+	size_t bucket;
+	/* The entry `hash_table_base_iterator_next` returns next. */
+	void *next;
+};
+
+void hash_table_base_iterator_begin(struct hash_table_base_iterator *iterator,
+                                    struct hash_table_base *hash_table);
+/* Returns false once there are no entries left. */
+bool hash_table_base_iterator_next(struct hash_table_base_iterator *iterator,
+                                   const char **key,
+                                   uint32_t *value);
 /* Destroy a hash table, returned from `hash_table_base_create`. This function
    should free all associated memory that the hash table used. It should pass
    `valgrind` with no leaks. */
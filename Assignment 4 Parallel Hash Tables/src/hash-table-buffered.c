@@ -0,0 +1,262 @@
+#include "hash-table-buffered.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Big enough that most buckets get several keys from one buffer. */
+#define BUFFER_ENTRIES 8192
+
+/* Writers wait once this many full buffers per merge thread are queued, so
+   writers that are faster than the merge don't use up all the memory. */
+#define QUEUED_PER_THREAD 4
+
+struct buffer {
+	struct buffer *next;
+	/* Numbers buffers in the order they're handed over. */
+	uint64_t sequence;
+	size_t count;
+	const char *keys[BUFFER_ENTRIES];
+	uint32_t values[BUFFER_ENTRIES];
+};
+
+struct hash_table_buffered {
+	struct hash_table_v2 *hash_table;
+	pthread_mutex_t mutex;
+	/* Signalled when a buffer is queued or we're stopping. */
+	pthread_cond_t queued;
+	/* Signalled when a buffer is merged. */
+	pthread_cond_t merged;
+	/* Full buffers, oldest first. */
+	struct buffer *head;
+	struct buffer *tail;
+	size_t queue_length;
+	/* Empty buffers, so we don't allocate one for every handover. */
+	struct buffer *free_buffers;
+	/* Buffers handed over to, and taken off, the queue so far. */
+	uint64_t handed_over;
+	uint64_t dequeued;
+	bool stopping;
+	uint32_t thread_count;
+	struct merge_thread *threads;
+};
+
+/* The queue is first in, first out, so every buffer before `dequeued` has
+   been taken off it. Those are merged unless a merge thread is still busy
+   with one, which is what `merging` tells us. */
+struct merge_thread {
+	struct hash_table_buffered *buffered;
+	pthread_t thread;
+	/* The sequence of the buffer being merged, `UINT64_MAX` if none. */
+	uint64_t merging;
+};
+
+struct hash_table_buffered_writer {
+	struct hash_table_buffered *buffered;
+	struct buffer *buffer;
+};
+
+static void merge(struct hash_table_buffered *buffered, struct buffer *buffer)
+{
+	hash_table_v2_add_batch(buffered->hash_table, buffer->keys, buffer->values,
+	                        buffer->count);
+}
+
+/* Both called with the mutex held. */
+static struct buffer *get_buffer(struct hash_table_buffered *buffered)
+{
+	struct buffer *buffer = buffered->free_buffers;
+	if (buffer != NULL) {
+		buffered->free_buffers = buffer->next;
+	}
+	else {
+		buffer = malloc(sizeof(struct buffer));
+		assert(buffer != NULL);
+	}
+	buffer->next = NULL;
+	buffer->count = 0;
+	return buffer;
+}
+
+static void put_buffer(struct hash_table_buffered *buffered, struct buffer *buffer)
+{
+	buffer->next = buffered->free_buffers;
+	buffered->free_buffers = buffer;
+}
+
+static void *run_merge(void *arg)
+{
+	struct merge_thread *merge_thread = arg;
+	struct hash_table_buffered *buffered = merge_thread->buffered;
+	pthread_mutex_lock(&buffered->mutex);
+	while (true) {
+		while (buffered->head == NULL && !buffered->stopping) {
+			pthread_cond_wait(&buffered->queued, &buffered->mutex);
+		}
+		if (buffered->head == NULL) {
+			break;
+		}
+		struct buffer *buffer = buffered->head;
+		buffered->head = buffer->next;
+		if (buffered->head == NULL) {
+			buffered->tail = NULL;
+		}
+		--buffered->queue_length;
+		++buffered->dequeued;
+		merge_thread->merging = buffer->sequence;
+		/* There's room in the queue again */
+		pthread_cond_broadcast(&buffered->merged);
+		pthread_mutex_unlock(&buffered->mutex);
+
+		merge(buffered, buffer);
+
+		pthread_mutex_lock(&buffered->mutex);
+		put_buffer(buffered, buffer);
+		merge_thread->merging = UINT64_MAX;
+		pthread_cond_broadcast(&buffered->merged);
+	}
+	pthread_mutex_unlock(&buffered->mutex);
+	return NULL;
+}
+
+struct hash_table_buffered *hash_table_buffered_create(struct hash_table_v2 *hash_table,
+                                                       uint32_t merge_threads)
+{
+	struct hash_table_buffered *buffered = calloc(1, sizeof(struct hash_table_buffered));
+	assert(buffered != NULL);
+	buffered->hash_table = hash_table;
+	pthread_mutex_init(&buffered->mutex, NULL);
+	pthread_cond_init(&buffered->queued, NULL);
+	pthread_cond_init(&buffered->merged, NULL);
+	buffered->thread_count = merge_threads;
+	buffered->threads = calloc(merge_threads, sizeof(struct merge_thread));
+	assert(merge_threads == 0 || buffered->threads != NULL);
+	for (uint32_t i = 0; i < merge_threads; ++i) {
+		struct merge_thread *merge_thread = &buffered->threads[i];
+		merge_thread->buffered = buffered;
+		merge_thread->merging = UINT64_MAX;
+		int err = pthread_create(&merge_thread->thread, NULL, run_merge, merge_thread);
+		assert(err == 0);
+		(void) err;
+	}
+	return buffered;
+}
+
+struct hash_table_buffered_writer *hash_table_buffered_writer_create(struct hash_table_buffered *buffered)
+{
+	struct hash_table_buffered_writer *writer = malloc(sizeof(struct hash_table_buffered_writer));
+	assert(writer != NULL);
+	writer->buffered = buffered;
+	pthread_mutex_lock(&buffered->mutex);
+	writer->buffer = get_buffer(buffered);
+	pthread_mutex_unlock(&buffered->mutex);
+	return writer;
+}
+
+/* Queues the writer's buffer and gives it an empty one. */
+static void hand_over(struct hash_table_buffered_writer *writer)
+{
+	struct hash_table_buffered *buffered = writer->buffered;
+	struct buffer *buffer = writer->buffer;
+	if (buffer->count == 0) {
+		return;
+	}
+	if (buffered->thread_count == 0) {
+		merge(buffered, buffer);
+		buffer->count = 0;
+		return;
+	}
+
+	pthread_mutex_lock(&buffered->mutex);
+	size_t limit = (size_t) buffered->thread_count * QUEUED_PER_THREAD;
+	while (buffered->queue_length >= limit) {
+		pthread_cond_wait(&buffered->merged, &buffered->mutex);
+	}
+	if (buffered->tail != NULL) {
+		buffered->tail->next = buffer;
+	}
+	else {
+		buffered->head = buffer;
+	}
+	buffered->tail = buffer;
+	++buffered->queue_length;
+	buffer->sequence = buffered->handed_over++;
+	pthread_cond_signal(&buffered->queued);
+	writer->buffer = get_buffer(buffered);
+	pthread_mutex_unlock(&buffered->mutex);
+}
+
+void hash_table_buffered_writer_add(struct hash_table_buffered_writer *writer,
+                                    const char *key,
+                                    uint32_t value)
+{
+	assert(key != NULL);
+	struct buffer *buffer = writer->buffer;
+	buffer->keys[buffer->count] = key;
+	buffer->values[buffer->count] = value;
+	if (++buffer->count == BUFFER_ENTRIES) {
+		hand_over(writer);
+	}
+}
+
+void hash_table_buffered_writer_flush(struct hash_table_buffered_writer *writer)
+{
+	hand_over(writer);
+}
+
+void hash_table_buffered_writer_destroy(struct hash_table_buffered_writer *writer)
+{
+	hand_over(writer);
+	struct hash_table_buffered *buffered = writer->buffered;
+	pthread_mutex_lock(&buffered->mutex);
+	put_buffer(buffered, writer->buffer);
+	pthread_mutex_unlock(&buffered->mutex);
+	free(writer);
+}
+
+/* Called with the mutex held. */
+static bool merged_before(struct hash_table_buffered *buffered, uint64_t sequence)
+{
+	if (buffered->dequeued < sequence) {
+		return false;
+	}
+	for (uint32_t i = 0; i < buffered->thread_count; ++i) {
+		if (buffered->threads[i].merging < sequence) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void hash_table_buffered_flush(struct hash_table_buffered *buffered)
+{
+	pthread_mutex_lock(&buffered->mutex);
+	uint64_t target = buffered->handed_over;
+	while (!merged_before(buffered, target)) {
+		pthread_cond_wait(&buffered->merged, &buffered->mutex);
+	}
+	pthread_mutex_unlock(&buffered->mutex);
+}
+
+void hash_table_buffered_destroy(struct hash_table_buffered *buffered)
+{
+	pthread_mutex_lock(&buffered->mutex);
+	buffered->stopping = true;
+	pthread_cond_broadcast(&buffered->queued);
+	pthread_mutex_unlock(&buffered->mutex);
+	/* The merge threads empty the queue before they stop */
+	for (uint32_t i = 0; i < buffered->thread_count; ++i) {
+		pthread_join(buffered->threads[i].thread, NULL);
+	}
+	free(buffered->threads);
+
+	while (buffered->free_buffers != NULL) {
+		struct buffer *buffer = buffered->free_buffers;
+		buffered->free_buffers = buffer->next;
+		free(buffer);
+	}
+	pthread_cond_destroy(&buffered->queued);
+	pthread_cond_destroy(&buffered->merged);
+	pthread_mutex_destroy(&buffered->mutex);
+	free(buffered);
+}
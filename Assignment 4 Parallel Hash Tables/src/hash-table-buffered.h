@@ -0,0 +1,39 @@
+#pragma once
+
+#include "hash-table-v2.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Write buffering on top of a `hash_table_v2`, for bulk loads where nobody
+   needs to see a key as soon as it's added. Every writer thread appends to
+   a buffer of its own without any synchronization. Full buffers are handed
+   to background merge threads, which add them to the table with
+   `hash_table_v2_add_batch`, so the table's locks are taken once per bucket
+   per buffer instead of once per key.
+
+   A key shows up in the table some time after it's added, and for sure
+   once the writer has been flushed and `hash_table_buffered_flush` has
+   returned. Until then the key's string has to stay around, the table only
+   makes its own copy when the key is merged. With more than one merge
+   thread, two buffers can be merged in either order, so if a key is added
+   more than once it's not defined which value wins. */
+struct hash_table_buffered;
+/* One per writer thread, never shared. */
+struct hash_table_buffered_writer;
+
+/* With no merge threads, full buffers get merged by the writer itself. */
+struct hash_table_buffered *hash_table_buffered_create(struct hash_table_v2 *hash_table,
+                                                       uint32_t merge_threads);
+struct hash_table_buffered_writer *hash_table_buffered_writer_create(struct hash_table_buffered *buffered);
+void hash_table_buffered_writer_add(struct hash_table_buffered_writer *writer,
+                                    const char *key,
+                                    uint32_t value);
+/* Hands the writer's buffer over to be merged even if it isn't full. */
+void hash_table_buffered_writer_flush(struct hash_table_buffered_writer *writer);
+/* Flushes the writer first. */
+void hash_table_buffered_writer_destroy(struct hash_table_buffered_writer *writer);
+/* Waits until every buffer handed over so far is in the table. */
+void hash_table_buffered_flush(struct hash_table_buffered *buffered);
+/* Flushes, stops the merge threads and leaves the table to the caller. */
+void hash_table_buffered_destroy(struct hash_table_buffered *buffered);
@@ -1,7 +1,16 @@
 #include "hash-table-common.h"
 
+#include <malloc.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
 
 uint32_t bernstein_hash(const char *string)
 {
@@ -17,3 +26,176 @@ uint32_t bernstein_hash(const char *string)
 	}
 	return hash;
 }
+
+/* Keys aren't aligned, `memcpy` compiles down to a single unaligned load. */
+static uint64_t read_u64(const char *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/* Reads the last `length` (less than 8) bytes of a key into a word. */
+static uint64_t read_tail(const char *p, size_t length)
+{
+	uint64_t value = 0;
+	memcpy(&value, p, length);
+	return value;
+}
+
+static uint64_t wymix(uint64_t a, uint64_t b)
+{
+	__uint128_t product = (__uint128_t) a * b;
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+#define WYHASH_P0 0xa0761d6478bd642fULL
+#define WYHASH_P1 0xe7037ed1a0b428dbULL
+#define WYHASH_P2 0x8ebc6af09c88c6e3ULL
+
+uint32_t wyhash_hash(const char *string)
+{
+	size_t length = strlen(string);
+	uint64_t hash = wymix(length ^ WYHASH_P0, WYHASH_P1);
+	const char *p = string;
+	size_t remaining = length;
+	while (remaining >= 8) {
+		hash = wymix(read_u64(p) ^ WYHASH_P1, hash ^ WYHASH_P2);
+		p += 8;
+		remaining -= 8;
+	}
+	hash = wymix(read_tail(p, remaining) ^ WYHASH_P0, hash ^ WYHASH_P1);
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+/* The software fallback works a bit at a time with the reflected CRC32C
+   (Castagnoli) polynomial. It's slow, but it gives the same results as the
+   instruction. */
+static uint32_t crc32c_software(uint32_t crc, const char *p, size_t length)
+{
+	for (size_t i = 0; i < length; ++i) {
+		crc ^= (uint8_t) p[i];
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+		}
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const char *p, size_t length)
+{
+	uint64_t crc64 = crc;
+	while (length >= 8) {
+		crc64 = _mm_crc32_u64(crc64, read_u64(p));
+		p += 8;
+		length -= 8;
+	}
+	crc = crc64;
+	while (length > 0) {
+		crc = _mm_crc32_u8(crc, *p);
+		++p;
+		--length;
+	}
+	return crc;
+}
+
+static bool crc32c_supported(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32c_hardware(uint32_t crc, const char *p, size_t length)
+{
+	while (length >= 8) {
+		crc = __crc32cd(crc, read_u64(p));
+		p += 8;
+		length -= 8;
+	}
+	while (length > 0) {
+		crc = __crc32cb(crc, *p);
+		++p;
+		--length;
+	}
+	return crc;
+}
+
+static bool crc32c_supported(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+static uint32_t crc32c_hardware(uint32_t crc, const char *p, size_t length)
+{
+	return crc32c_software(crc, p, length);
+}
+
+static bool crc32c_supported(void)
+{
+	return false;
+}
+#endif
+
+uint32_t crc32c_hash(const char *string)
+{
+	/* 0 means we haven't checked the CPU yet, 1 is no, 2 is yes. Racing
+	   threads all store the same answer. */
+	static int supported = 0;
+	int cached = __atomic_load_n(&supported, __ATOMIC_RELAXED);
+	if (cached == 0) {
+		cached = crc32c_supported() ? 2 : 1;
+		__atomic_store_n(&supported, cached, __ATOMIC_RELAXED);
+	}
+
+	size_t length = strlen(string);
+	uint32_t crc;
+	if (cached == 2) {
+		crc = crc32c_hardware(~0U, string, length);
+	}
+	else {
+		crc = crc32c_software(~0U, string, length);
+	}
+	return ~crc;
+}
+
+const struct hash_function_info hash_functions[] = {
+	{ "bernstein", bernstein_hash },
+	{ "wyhash", wyhash_hash },
+	{ "crc32c", crc32c_hash },
+};
+
+const size_t hash_functions_count = sizeof(hash_functions) / sizeof(hash_functions[0]);
+
+hash_function *hash_function_find(const char *name)
+{
+	for (size_t i = 0; i < hash_functions_count; ++i) {
+		if (strcmp(hash_functions[i].name, name) == 0) {
+			return hash_functions[i].function;
+		}
+	}
+	return NULL;
+}
+
+const char *hash_function_name(hash_function *function)
+{
+	for (size_t i = 0; i < hash_functions_count; ++i) {
+		if (hash_functions[i].function == function) {
+			return hash_functions[i].name;
+		}
+	}
+	return NULL;
+}
+
+size_t hash_table_memory_usage_total(const struct hash_table_memory_usage *usage)
+{
+	return usage->table_bytes + usage->bucket_bytes + usage->lock_bytes
+	       + usage->entry_bytes + usage->key_bytes;
+}
+
+/* glibc keeps the size of every allocation in the word before it. */
+size_t hash_table_heap_bytes(void *pointer)
+{
+	return malloc_usable_size(pointer) + sizeof(size_t);
+}
@@ -1,11 +1,60 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* All of our hash tables will have the same capcity so we can create a fair
    comparsion. */
 #define HASH_TABLE_CAPACITY 4096
 
+/* Every hash function takes a NUL-terminated key and returns 32 bits, the
+   tables use the bottom bits to pick a bucket. */
+typedef uint32_t hash_function(const char *string);
+
 /* We'll also use the same hash function for all our hash tables, called the
    bernstein hash. You may also find it referred to as the djb2 hash. */
 uint32_t bernstein_hash(const char *string);
+
+/* A wyhash-style hash that consumes the key 8 bytes at a time and mixes with
+   64x64->128 bit multiplies, so every input bit affects the bottom bits. */
+uint32_t wyhash_hash(const char *string);
+
+/* CRC32C of the key, using the CPU's CRC32C instruction (SSE 4.2 on x86-64,
+   the CRC extension on aarch64) when there is one. */
+uint32_t crc32c_hash(const char *string);
+
+struct hash_function_info {
+	const char *name;
+	hash_function *function;
+};
+
+/* Every hash function above, the first one is the default. */
+extern const struct hash_function_info hash_functions[];
+extern const size_t hash_functions_count;
+
+/* Returns the hash function with this name, or `NULL` if there isn't one. */
+hash_function *hash_function_find(const char *name);
+/* Returns the name of one of our hash functions, or `NULL` if `function`
+   isn't one of them. */
+const char *hash_function_name(hash_function *function);
+
+/* What a table's memory goes to, every table fills this in with its
+   `*_memory_usage` function. Only counts memory the table allocated, not the
+   caller's keys, and nothing may be changing the table meanwhile. */
+struct hash_table_memory_usage {
+	/* The table's own struct, not counting the buckets and locks in it. */
+	size_t table_bytes;
+	size_t bucket_bytes;
+	size_t lock_bytes;
+	/* Every entry, and memory set aside for entries but not used yet. */
+	size_t entry_bytes;
+	/* Copies of keys kept outside of the entries. */
+	size_t key_bytes;
+	/* How many keys are in the table. */
+	size_t keys;
+};
+
+size_t hash_table_memory_usage_total(const struct hash_table_memory_usage *usage);
+/* Returns how much of the heap `malloc` gave up for `pointer`, including
+   its bookkeeping. */
+size_t hash_table_heap_bytes(void *pointer);
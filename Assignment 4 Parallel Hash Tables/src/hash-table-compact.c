@@ -0,0 +1,342 @@
+#include "hash-table-compact.h"
+
+#include "thread-slot.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The first chunk of entries, every next one is twice as big up to
+   `MAX_CHUNK_SIZE`. */
+#define MIN_CHUNK_SIZE 256
+#define MAX_CHUNK_SIZE (64 * 1024)
+
+/* A small table carves all of its entries from chunks it shares between
+   threads, so it doesn't keep a partly filled chunk for every thread that
+   wrote to it. Once those add up to this many bytes, every thread fills
+   chunks of its own. */
+#define SHARED_CHUNK_BYTES (4 * 1024)
+
+/* The bucket array is allocated a page of buckets at a time, the first time
+   a key lands in one of them. */
+#define BUCKETS_PER_PAGE 64
+#define PAGES ((HASH_TABLE_CAPACITY + BUCKETS_PER_PAGE - 1) / BUCKETS_PER_PAGE)
+
+/* The key follows the entry directly, and the next entry starts at the next
+   multiple of 8 bytes. A 7 letter key takes 24 bytes in all. */
+struct entry {
+	struct entry *_Atomic next;
+	uint32_t hash;
+	_Atomic uint32_t value;
+	char key[];
+};
+
+/* A shared chunk is carved under `chunk_lock`, any other belongs to the
+   thread that allocated it, and only that thread carves entries from it. */
+struct chunk {
+	struct chunk *previous;
+	size_t size;
+	size_t used;
+	alignas(8) char entries[];
+};
+
+/* The lock of a bucket is right after the bucket heads in the same page.
+   An empty list and an unlocked flag are both zero. */
+struct bucket_page {
+	struct entry *_Atomic heads[BUCKETS_PER_PAGE];
+	atomic_flag locks[BUCKETS_PER_PAGE];
+};
+
+/* The chunk a thread is filling is its element of `thread_chunks`, only
+   that thread touches it. */
+struct buckets {
+	struct bucket_page *_Atomic pages[PAGES];
+	struct thread_slot_array thread_chunks;
+};
+
+_Static_assert(sizeof(atomic_flag) == 1, "a lock should be a single byte");
+
+struct hash_table_compact {
+	struct buckets *_Atomic buckets;
+	/* Every chunk, so we can free them. */
+	struct chunk *chunk;
+	/* The shared chunk we're carving and how big all of them are. */
+	struct chunk *shared_chunk;
+	size_t shared_bytes;
+	/* Set once the shared chunks are used up. */
+	atomic_bool thread_chunks;
+	/* Held to carve a shared chunk or to add any chunk to the list. */
+	atomic_flag chunk_lock;
+};
+
+struct hash_table_compact *hash_table_compact_create()
+{
+	struct hash_table_compact *hash_table = malloc(sizeof(struct hash_table_compact));
+	assert(hash_table != NULL);
+	atomic_init(&hash_table->buckets, NULL);
+	hash_table->chunk = NULL;
+	hash_table->shared_chunk = NULL;
+	hash_table->shared_bytes = 0;
+	atomic_init(&hash_table->thread_chunks, false);
+	atomic_flag_clear(&hash_table->chunk_lock);
+	return hash_table;
+}
+
+static void lock(atomic_flag *flag)
+{
+	while (atomic_flag_test_and_set_explicit(flag, memory_order_acquire)) {
+		sched_yield();
+	}
+}
+
+static void unlock(atomic_flag *flag)
+{
+	atomic_flag_clear_explicit(flag, memory_order_release);
+}
+
+/* Whoever inserts first allocates the buckets, if two threads race the
+   loser frees its copy. */
+static struct buckets *get_buckets(struct hash_table_compact *hash_table)
+{
+	struct buckets *buckets = atomic_load_explicit(&hash_table->buckets,
+	                                               memory_order_acquire);
+	if (buckets != NULL) {
+		return buckets;
+	}
+	struct buckets *new_buckets = calloc(1, sizeof(struct buckets));
+	assert(new_buckets != NULL);
+	thread_slot_array_init(&new_buckets->thread_chunks, sizeof(struct chunk *),
+	                       alignof(struct chunk *));
+	if (atomic_compare_exchange_strong_explicit(&hash_table->buckets, &buckets,
+	                                            new_buckets,
+	                                            memory_order_acq_rel,
+	                                            memory_order_acquire)) {
+		return new_buckets;
+	}
+	free(new_buckets);
+	return buckets;
+}
+
+/* Pages are allocated the same way as the buckets. */
+static struct bucket_page *get_page(struct buckets *buckets, size_t index)
+{
+	struct bucket_page *_Atomic *pointer = &buckets->pages[index / BUCKETS_PER_PAGE];
+	struct bucket_page *page = atomic_load_explicit(pointer, memory_order_acquire);
+	if (page != NULL) {
+		return page;
+	}
+	struct bucket_page *new_page = calloc(1, sizeof(struct bucket_page));
+	assert(new_page != NULL);
+	if (atomic_compare_exchange_strong_explicit(pointer, &page, new_page,
+	                                            memory_order_acq_rel,
+	                                            memory_order_acquire)) {
+		return new_page;
+	}
+	free(new_page);
+	return page;
+}
+
+static struct chunk *chunk_create(size_t size, size_t bytes)
+{
+	if (size > MAX_CHUNK_SIZE) {
+		size = MAX_CHUNK_SIZE;
+	}
+	if (size < bytes) {
+		size = bytes;
+	}
+	struct chunk *chunk = malloc(sizeof(struct chunk) + size);
+	assert(chunk != NULL);
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+/* Must hold `chunk_lock`. Returns `NULL` once the shared chunks are used
+   up. */
+static struct entry *shared_alloc(struct hash_table_compact *hash_table,
+                                  size_t bytes)
+{
+	struct chunk *chunk = hash_table->shared_chunk;
+	if (chunk == NULL || chunk->used + bytes > chunk->size) {
+		size_t size = chunk == NULL ? MIN_CHUNK_SIZE : chunk->size * 2;
+		if (hash_table->shared_bytes + size > SHARED_CHUNK_BYTES || size < bytes) {
+			atomic_store_explicit(&hash_table->thread_chunks, true,
+			                      memory_order_relaxed);
+			return NULL;
+		}
+		chunk = chunk_create(size, bytes);
+		chunk->previous = hash_table->chunk;
+		hash_table->chunk = chunk;
+		hash_table->shared_chunk = chunk;
+		hash_table->shared_bytes += size;
+	}
+	struct entry *entry = (struct entry *) (chunk->entries + chunk->used);
+	chunk->used += bytes;
+	return entry;
+}
+
+/* Once the shared chunks are used up, entries are carved from the calling
+   thread's own chunk, so inserts in different buckets share nothing. The
+   lock is then only taken when a thread runs off the end of its chunk and
+   links a new one. */
+static struct entry *entry_alloc(struct hash_table_compact *hash_table,
+                                 struct buckets *buckets, size_t key_length)
+{
+	size_t bytes = (sizeof(struct entry) + key_length + 1 + 7) / 8 * 8;
+	if (!atomic_load_explicit(&hash_table->thread_chunks, memory_order_relaxed)) {
+		lock(&hash_table->chunk_lock);
+		struct entry *entry = shared_alloc(hash_table, bytes);
+		unlock(&hash_table->chunk_lock);
+		if (entry != NULL) {
+			return entry;
+		}
+	}
+
+	struct chunk **thread_chunk = thread_slot_array_get(&buckets->thread_chunks,
+	                                                    thread_slot_get());
+	struct chunk *chunk = *thread_chunk;
+	if (chunk == NULL || chunk->used + bytes > chunk->size) {
+		chunk = chunk_create(chunk == NULL ? MIN_CHUNK_SIZE : chunk->size * 2,
+		                     bytes);
+		*thread_chunk = chunk;
+		lock(&hash_table->chunk_lock);
+		chunk->previous = hash_table->chunk;
+		hash_table->chunk = chunk;
+		unlock(&hash_table->chunk_lock);
+	}
+	struct entry *entry = (struct entry *) (chunk->entries + chunk->used);
+	chunk->used += bytes;
+	return entry;
+}
+
+static struct entry *get_entry(struct entry *_Atomic *head, const char *key,
+                               uint32_t hash)
+{
+	struct entry *entry = atomic_load_explicit(head, memory_order_acquire);
+	while (entry != NULL) {
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+		entry = atomic_load_explicit(&entry->next, memory_order_acquire);
+	}
+	return NULL;
+}
+
+void hash_table_compact_add_entry(struct hash_table_compact *hash_table,
+                                  const char *key,
+                                  uint32_t value)
+{
+	assert(key != NULL);
+	uint32_t hash = bernstein_hash(key);
+	size_t index = hash % HASH_TABLE_CAPACITY;
+	struct buckets *buckets = get_buckets(hash_table);
+	struct bucket_page *page = get_page(buckets, index);
+	struct entry *_Atomic *head = &page->heads[index % BUCKETS_PER_PAGE];
+	atomic_flag *bucket_lock = &page->locks[index % BUCKETS_PER_PAGE];
+
+	lock(bucket_lock);
+	struct entry *entry = get_entry(head, key, hash);
+
+	/* Update the value if it already exists */
+	if (entry != NULL) {
+		atomic_store_explicit(&entry->value, value, memory_order_relaxed);
+		unlock(bucket_lock);
+		return;
+	}
+
+	size_t length = strlen(key);
+	entry = entry_alloc(hash_table, buckets, length);
+	entry->hash = hash;
+	atomic_init(&entry->value, value);
+	memcpy(entry->key, key, length + 1);
+	atomic_init(&entry->next, atomic_load_explicit(head, memory_order_relaxed));
+	atomic_store_explicit(head, entry, memory_order_release);
+	unlock(bucket_lock);
+}
+
+static struct entry *lookup(struct hash_table_compact *hash_table, const char *key)
+{
+	assert(key != NULL);
+	struct buckets *buckets = atomic_load_explicit(&hash_table->buckets,
+	                                               memory_order_acquire);
+	if (buckets == NULL) {
+		return NULL;
+	}
+	uint32_t hash = bernstein_hash(key);
+	size_t index = hash % HASH_TABLE_CAPACITY;
+	struct bucket_page *page = atomic_load_explicit(&buckets->pages[index / BUCKETS_PER_PAGE],
+	                                                memory_order_acquire);
+	if (page == NULL) {
+		return NULL;
+	}
+	return get_entry(&page->heads[index % BUCKETS_PER_PAGE], key, hash);
+}
+
+bool hash_table_compact_contains(struct hash_table_compact *hash_table,
+                                 const char *key)
+{
+	return lookup(hash_table, key) != NULL;
+}
+
+uint32_t hash_table_compact_get_value(struct hash_table_compact *hash_table,
+                                      const char *key)
+{
+	struct entry *entry = lookup(hash_table, key);
+	assert(entry != NULL);
+	return atomic_load_explicit(&entry->value, memory_order_relaxed);
+}
+
+void hash_table_compact_memory_usage(struct hash_table_compact *hash_table,
+                                     struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->table_bytes = sizeof(struct hash_table_compact);
+	struct buckets *buckets = atomic_load(&hash_table->buckets);
+	if (buckets != NULL) {
+		usage->table_bytes += sizeof(struct buckets)
+		                      + thread_slot_array_bytes(&buckets->thread_chunks);
+		for (size_t i = 0; i < PAGES; ++i) {
+			struct bucket_page *page = atomic_load(&buckets->pages[i]);
+			if (page == NULL) {
+				continue;
+			}
+			usage->bucket_bytes += sizeof(page->heads);
+			usage->lock_bytes += sizeof(page->locks);
+			for (size_t j = 0; j < BUCKETS_PER_PAGE; ++j) {
+				for (struct entry *entry = atomic_load(&page->heads[j]);
+				     entry != NULL;
+				     entry = atomic_load(&entry->next)) {
+					++usage->keys;
+				}
+			}
+		}
+	}
+	lock(&hash_table->chunk_lock);
+	for (struct chunk *chunk = hash_table->chunk; chunk != NULL;
+	     chunk = chunk->previous) {
+		usage->entry_bytes += sizeof(struct chunk) + chunk->size;
+	}
+	unlock(&hash_table->chunk_lock);
+}
+
+void hash_table_compact_destroy(struct hash_table_compact *hash_table)
+{
+	struct chunk *chunk = hash_table->chunk;
+	while (chunk != NULL) {
+		struct chunk *previous = chunk->previous;
+		free(chunk);
+		chunk = previous;
+	}
+	struct buckets *buckets = atomic_load(&hash_table->buckets);
+	if (buckets != NULL) {
+		for (size_t i = 0; i < PAGES; ++i) {
+			free(atomic_load(&buckets->pages[i]));
+		}
+		thread_slot_array_destroy(&buckets->thread_chunks);
+		free(buckets);
+	}
+	free(hash_table);
+}
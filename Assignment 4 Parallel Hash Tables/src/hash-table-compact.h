@@ -0,0 +1,30 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* A hash table for when there are many of them, most of them small. An empty
+   table is a few bytes. The bucket array is allocated 64 buckets at a time,
+   the first time a key lands in one of them, and a bucket is a single
+   pointer plus a 1 byte lock. Entries are packed one after the other in
+   chunks that double in size as the table grows, with the key copied right
+   after the value, instead of every entry being its own allocation. A small
+   table shares its chunks between threads, after 4 KB of them every thread
+   that inserts fills chunks of its own. After the first insert a table is
+   about 1.7 KB, 7 KB with 10 keys, where a v2 table is 328 KB. Once every
+   page is in use the buckets and locks are 36 KB, v2's are 256 KB before
+   the first key. Lookups take no locks. There are no removes. */
+struct hash_table_compact;
+struct hash_table_compact *hash_table_compact_create();
+/* The table keeps its own copy of the key. */
+void hash_table_compact_add_entry(struct hash_table_compact *hash_table,
+                                  const char *key,
+                                  uint32_t value);
+bool hash_table_compact_contains(struct hash_table_compact *hash_table,
+                                 const char *key);
+uint32_t hash_table_compact_get_value(struct hash_table_compact *hash_table,
+                                      const char* key);
+void hash_table_compact_memory_usage(struct hash_table_compact *hash_table,
+                                     struct hash_table_memory_usage *usage);
+void hash_table_compact_destroy(struct hash_table_compact *hash_table);
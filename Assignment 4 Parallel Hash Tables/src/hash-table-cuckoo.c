@@ -0,0 +1,505 @@
+#include "hash-table-cuckoo.h"
+
+#include "epoch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOTS_PER_BUCKET 4
+
+/* Buckets share this many version counters, bucket `i` uses `i % STRIPES`. */
+#define STRIPES 1024
+
+/* How many buckets the search for a free slot may look at before we give
+   up and grow the table. */
+#define MAX_SEARCH 512
+
+/* The most pause instructions between two checks of a stripe that's being
+   written. Past that we give up the CPU, a writer that got preempted in the
+   middle of a move can't finish while we spin on its core. */
+#define MAX_BACKOFF 64
+
+/* Every slot records the first hash of its key, whichever bucket it's in,
+   so most slots that don't match are skipped without touching the key. An
+   empty slot has a `NULL` key. Slots are read while writers change them,
+   so every field is atomic. */
+struct slot {
+	_Atomic(const char *) key;
+	_Atomic uint32_t hash;
+	_Atomic uint32_t value;
+};
+
+struct bucket {
+	alignas(64) struct slot slots[SLOTS_PER_BUCKET];
+};
+
+/* A sequence lock: odd while a writer holds it, and bumped again when the
+   writer is done. A reader that saw the same even version before and after
+   reading knows nothing changed in between. */
+struct stripe {
+	alignas(64) _Atomic uint32_t version;
+};
+
+struct bucket_array {
+	size_t bucket_count;
+	struct stripe stripes[STRIPES];
+	struct bucket buckets[];
+};
+
+/* Writers that only fill in a free slot share `resize_lock`. Moving keys
+   around or growing the table takes it exclusively, so then no other writer
+   is running and only readers have to be kept consistent. */
+struct hash_table_cuckoo {
+	struct bucket_array *_Atomic current;
+	pthread_rwlock_t resize_lock;
+	_Atomic uint32_t resize_count;
+	struct epoch_domain epoch;
+};
+
+static void reclaim_array(void *object, void *context)
+{
+	(void) context;
+	free(object);
+}
+
+static struct bucket_array *bucket_array_create(size_t bucket_count)
+{
+	size_t bytes = sizeof(struct bucket_array) + bucket_count * sizeof(struct bucket);
+	struct bucket_array *array = aligned_alloc(alignof(struct bucket_array),
+	                                           (bytes + 63) / 64 * 64);
+	assert(array != NULL);
+	memset(array, 0, bytes);
+	array->bucket_count = bucket_count;
+	return array;
+}
+
+struct hash_table_cuckoo *hash_table_cuckoo_create()
+{
+	struct hash_table_cuckoo *hash_table = aligned_alloc(alignof(struct hash_table_cuckoo),
+	                                                     sizeof(struct hash_table_cuckoo));
+	assert(hash_table != NULL);
+	memset(hash_table, 0, sizeof(struct hash_table_cuckoo));
+	/* A slot per key of the other tables' buckets */
+	atomic_init(&hash_table->current,
+	            bucket_array_create(HASH_TABLE_CAPACITY / SLOTS_PER_BUCKET));
+	pthread_rwlock_init(&hash_table->resize_lock, NULL);
+	atomic_init(&hash_table->resize_count, 0);
+	epoch_domain_init(&hash_table->epoch, reclaim_array, NULL);
+	return hash_table;
+}
+
+/* The bucket count is a power of two. If both hashes pick the same bucket
+   the key simply has only one. */
+static size_t first_bucket(struct bucket_array *array, uint32_t hash)
+{
+	return hash & (array->bucket_count - 1);
+}
+
+static size_t second_bucket(struct bucket_array *array, const char *key)
+{
+	return wyhash_hash(key) & (array->bucket_count - 1);
+}
+
+static struct stripe *get_stripe(struct bucket_array *array, size_t bucket)
+{
+	return &array->stripes[bucket % STRIPES];
+}
+
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+/* Waits a little longer every time it's called, `backoff` starts at 1. */
+static void wait_for_writer(uint32_t *backoff)
+{
+	if (*backoff > MAX_BACKOFF) {
+		sched_yield();
+		return;
+	}
+	for (uint32_t i = 0; i < *backoff; ++i) {
+		cpu_relax();
+	}
+	*backoff *= 2;
+}
+
+static void lock_stripe(struct stripe *stripe)
+{
+	uint32_t backoff = 1;
+	while (true) {
+		uint32_t version = atomic_load_explicit(&stripe->version, memory_order_relaxed);
+		if ((version & 1) == 0
+		    && atomic_compare_exchange_weak_explicit(&stripe->version, &version,
+		                                             version + 1,
+		                                             memory_order_acquire,
+		                                             memory_order_relaxed)) {
+			break;
+		}
+		wait_for_writer(&backoff);
+	}
+	/* Our writes to the slots can't be seen before the odd version */
+	atomic_thread_fence(memory_order_release);
+}
+
+static void unlock_stripe(struct stripe *stripe)
+{
+	atomic_fetch_add_explicit(&stripe->version, 1, memory_order_release);
+}
+
+/* Always in the same order, so two writers can't deadlock. */
+static void lock_stripes(struct stripe *a, struct stripe *b)
+{
+	if (a == b) {
+		lock_stripe(a);
+	}
+	else if (a < b) {
+		lock_stripe(a);
+		lock_stripe(b);
+	}
+	else {
+		lock_stripe(b);
+		lock_stripe(a);
+	}
+}
+
+static void unlock_stripes(struct stripe *a, struct stripe *b)
+{
+	unlock_stripe(a);
+	if (a != b) {
+		unlock_stripe(b);
+	}
+}
+
+static struct slot *find_slot(struct bucket *bucket, const char *key, uint32_t hash)
+{
+	for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+		struct slot *slot = &bucket->slots[i];
+		const char *slot_key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+		if (slot_key != NULL
+		    && atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash
+		    && strcmp(slot_key, key) == 0) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+static struct slot *find_empty_slot(struct bucket *bucket)
+{
+	for (size_t i = 0; i < SLOTS_PER_BUCKET; ++i) {
+		struct slot *slot = &bucket->slots[i];
+		if (atomic_load_explicit(&slot->key, memory_order_relaxed) == NULL) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+static void set_slot(struct slot *slot, const char *key, uint32_t hash, uint32_t value)
+{
+	atomic_store_explicit(&slot->hash, hash, memory_order_relaxed);
+	atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+	atomic_store_explicit(&slot->key, key, memory_order_relaxed);
+}
+
+/* Reads both of the key's buckets between two checks of their versions.
+   Both have to be covered by the same check, a key being moved from one to
+   the other could otherwise be missed in both. The keys we compare against
+   belong to the caller and are never freed, so it's fine if a slot changes
+   under us, we'd just retry. */
+static bool lookup(struct hash_table_cuckoo *hash_table, const char *key,
+                   uint32_t *value)
+{
+	assert(key != NULL);
+	uint32_t hash = bernstein_hash(key);
+	uint32_t second_hash = wyhash_hash(key);
+	bool found;
+
+	epoch_enter(&hash_table->epoch);
+	struct bucket_array *array = atomic_load_explicit(&hash_table->current,
+	                                                  memory_order_acquire);
+	size_t b1 = first_bucket(array, hash);
+	size_t b2 = second_hash & (array->bucket_count - 1);
+	struct stripe *s1 = get_stripe(array, b1);
+	struct stripe *s2 = get_stripe(array, b2);
+	uint32_t backoff = 1;
+	while (true) {
+		uint32_t v1 = atomic_load_explicit(&s1->version, memory_order_acquire);
+		uint32_t v2 = atomic_load_explicit(&s2->version, memory_order_acquire);
+		if ((v1 & 1) || (v2 & 1)) {
+			wait_for_writer(&backoff);
+			continue;
+		}
+		struct slot *slot = find_slot(&array->buckets[b1], key, hash);
+		if (slot == NULL) {
+			slot = find_slot(&array->buckets[b2], key, hash);
+		}
+		found = slot != NULL;
+		if (found) {
+			*value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&s1->version, memory_order_relaxed) == v1
+		    && atomic_load_explicit(&s2->version, memory_order_relaxed) == v2) {
+			break;
+		}
+	}
+	epoch_exit(&hash_table->epoch);
+	return found;
+}
+
+bool hash_table_cuckoo_contains(struct hash_table_cuckoo *hash_table,
+                                const char *key)
+{
+	uint32_t value;
+	return lookup(hash_table, key, &value);
+}
+
+uint32_t hash_table_cuckoo_get_value(struct hash_table_cuckoo *hash_table,
+                                     const char *key)
+{
+	uint32_t value = 0;
+	bool found = lookup(hash_table, key, &value);
+	assert(found);
+	(void) found;
+	return value;
+}
+
+/* The common case, the key is already there or one of its buckets has a
+   free slot. Returns false if neither. The caller holds `resize_lock`. */
+static bool try_add(struct bucket_array *array, const char *key, uint32_t hash,
+                    uint32_t value)
+{
+	size_t b1 = first_bucket(array, hash);
+	size_t b2 = second_bucket(array, key);
+	struct stripe *s1 = get_stripe(array, b1);
+	struct stripe *s2 = get_stripe(array, b2);
+	lock_stripes(s1, s2);
+
+	/* Update the value if it already exists */
+	struct slot *slot = find_slot(&array->buckets[b1], key, hash);
+	if (slot == NULL) {
+		slot = find_slot(&array->buckets[b2], key, hash);
+	}
+	if (slot != NULL) {
+		atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+		unlock_stripes(s1, s2);
+		return true;
+	}
+
+	slot = find_empty_slot(&array->buckets[b1]);
+	if (slot == NULL) {
+		slot = find_empty_slot(&array->buckets[b2]);
+	}
+	if (slot != NULL) {
+		set_slot(slot, key, hash, value);
+	}
+	unlock_stripes(s1, s2);
+	return slot != NULL;
+}
+
+/* One bucket the breadth-first search reached. We got here by moving the
+   key in slot `parent_slot` of the parent's bucket to its other bucket,
+   which is this one. */
+struct search_node {
+	size_t bucket;
+	int32_t parent;
+	uint32_t parent_slot;
+};
+
+/* Moves the key in `from` into the empty slot `to`. It's written to its new
+   slot before the old one is cleared, so readers always find it in one of
+   its buckets. */
+static void move_slot(struct bucket_array *array, size_t from_bucket,
+                      struct slot *from, size_t to_bucket, struct slot *to)
+{
+	struct stripe *to_stripe = get_stripe(array, to_bucket);
+	lock_stripe(to_stripe);
+	set_slot(to, atomic_load_explicit(&from->key, memory_order_relaxed),
+	         atomic_load_explicit(&from->hash, memory_order_relaxed),
+	         atomic_load_explicit(&from->value, memory_order_relaxed));
+	unlock_stripe(to_stripe);
+
+	struct stripe *from_stripe = get_stripe(array, from_bucket);
+	lock_stripe(from_stripe);
+	atomic_store_explicit(&from->key, NULL, memory_order_relaxed);
+	unlock_stripe(from_stripe);
+}
+
+/* A bucket can't show up twice on one chain, the later move would find its
+   slot already taken. */
+static bool on_path(struct search_node *nodes, size_t node, size_t bucket)
+{
+	for (int32_t i = (int32_t) node; i >= 0; i = nodes[i].parent) {
+		if (nodes[i].bucket == bucket) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Looks for a chain of moves that ends in a free slot, starting from the
+   key's two buckets, and then makes the moves from the free end backwards,
+   so every move goes into a slot that was just emptied. Returns false if no
+   chain was found. The caller holds `resize_lock` exclusively. */
+static bool add_with_moves(struct bucket_array *array, const char *key,
+                           uint32_t hash, uint32_t value)
+{
+	struct search_node *nodes = malloc(MAX_SEARCH * sizeof(struct search_node));
+	assert(nodes != NULL);
+	size_t count = 0;
+	nodes[count++] = (struct search_node) { first_bucket(array, hash), -1, 0 };
+	nodes[count++] = (struct search_node) { second_bucket(array, key), -1, 0 };
+
+	bool added = false;
+	for (size_t i = 0; i < count; ++i) {
+		struct bucket *bucket = &array->buckets[nodes[i].bucket];
+		struct slot *empty = find_empty_slot(bucket);
+		if (empty != NULL) {
+			size_t node = i;
+			while (nodes[node].parent >= 0) {
+				struct search_node *parent = &nodes[nodes[node].parent];
+				struct slot *from = &array->buckets[parent->bucket].slots[nodes[node].parent_slot];
+				move_slot(array, parent->bucket, from, nodes[node].bucket, empty);
+				empty = from;
+				node = nodes[node].parent;
+			}
+			struct stripe *stripe = get_stripe(array, nodes[node].bucket);
+			lock_stripe(stripe);
+			set_slot(empty, key, hash, value);
+			unlock_stripe(stripe);
+			added = true;
+			break;
+		}
+
+		for (uint32_t s = 0; s < SLOTS_PER_BUCKET && count < MAX_SEARCH; ++s) {
+			struct slot *slot = &bucket->slots[s];
+			const char *slot_key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+			uint32_t slot_hash = atomic_load_explicit(&slot->hash, memory_order_relaxed);
+			size_t other = first_bucket(array, slot_hash);
+			if (other == nodes[i].bucket) {
+				other = second_bucket(array, slot_key);
+			}
+			if (other == nodes[i].bucket || on_path(nodes, i, other)) {
+				continue;
+			}
+			nodes[count++] = (struct search_node) { other, (int32_t) i, s };
+		}
+	}
+	free(nodes);
+	return added;
+}
+
+/* Moves every key into a new array with `bucket_count` buckets. Nobody else
+   can see the new array yet, but moving keys around in it takes the same
+   path as in a live one. Returns `NULL` if some key still didn't fit. */
+static struct bucket_array *rehash(struct bucket_array *array, size_t bucket_count)
+{
+	struct bucket_array *new_array = bucket_array_create(bucket_count);
+	for (size_t i = 0; i < array->bucket_count; ++i) {
+		for (size_t s = 0; s < SLOTS_PER_BUCKET; ++s) {
+			struct slot *slot = &array->buckets[i].slots[s];
+			const char *key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+			if (key == NULL) {
+				continue;
+			}
+			uint32_t hash = atomic_load_explicit(&slot->hash, memory_order_relaxed);
+			uint32_t value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+			if (!try_add(new_array, key, hash, value)
+			    && !add_with_moves(new_array, key, hash, value)) {
+				free(new_array);
+				return NULL;
+			}
+		}
+	}
+	return new_array;
+}
+
+/* Readers may still be looking at the old array, so it goes through the
+   epoch domain instead of being freed. The old array isn't written to once
+   it's been replaced, whatever a reader finds there is still consistent. */
+static void grow(struct hash_table_cuckoo *hash_table)
+{
+	struct bucket_array *array = atomic_load_explicit(&hash_table->current,
+	                                                  memory_order_relaxed);
+	struct bucket_array *new_array = NULL;
+	for (size_t bucket_count = array->bucket_count * 2; new_array == NULL;
+	     bucket_count *= 2) {
+		new_array = rehash(array, bucket_count);
+		atomic_fetch_add_explicit(&hash_table->resize_count, 1, memory_order_relaxed);
+	}
+	atomic_store_explicit(&hash_table->current, new_array, memory_order_release);
+	epoch_retire(&hash_table->epoch, array);
+}
+
+void hash_table_cuckoo_add_entry(struct hash_table_cuckoo *hash_table,
+                                 const char *key,
+                                 uint32_t value)
+{
+	assert(key != NULL);
+	uint32_t hash = bernstein_hash(key);
+
+	pthread_rwlock_rdlock(&hash_table->resize_lock);
+	bool added = try_add(atomic_load_explicit(&hash_table->current, memory_order_relaxed),
+	                     key, hash, value);
+	pthread_rwlock_unlock(&hash_table->resize_lock);
+	if (added) {
+		return;
+	}
+
+	/* Another writer may have made room or added the key while we didn't
+	   hold the lock, so we have to try again before moving anything. */
+	pthread_rwlock_wrlock(&hash_table->resize_lock);
+	while (true) {
+		struct bucket_array *array = atomic_load_explicit(&hash_table->current,
+		                                                  memory_order_relaxed);
+		if (try_add(array, key, hash, value)
+		    || add_with_moves(array, key, hash, value)) {
+			break;
+		}
+		grow(hash_table);
+	}
+	pthread_rwlock_unlock(&hash_table->resize_lock);
+}
+
+uint32_t hash_table_cuckoo_resize_count(struct hash_table_cuckoo *hash_table)
+{
+	return atomic_load_explicit(&hash_table->resize_count, memory_order_relaxed);
+}
+
+/* The keys live in the buckets' slots. Arrays that were replaced may still
+   be waiting for the epoch to move on, they aren't counted. */
+void hash_table_cuckoo_memory_usage(struct hash_table_cuckoo *hash_table,
+                                    struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	struct bucket_array *array = atomic_load(&hash_table->current);
+	usage->table_bytes = sizeof(struct hash_table_cuckoo)
+	                     + sizeof(struct bucket_array) - sizeof(array->stripes);
+	usage->lock_bytes = sizeof(array->stripes);
+	usage->bucket_bytes = array->bucket_count * sizeof(struct bucket);
+	for (size_t i = 0; i < array->bucket_count; ++i) {
+		for (size_t s = 0; s < SLOTS_PER_BUCKET; ++s) {
+			if (atomic_load(&array->buckets[i].slots[s].key) != NULL) {
+				++usage->keys;
+			}
+		}
+	}
+}
+
+void hash_table_cuckoo_destroy(struct hash_table_cuckoo *hash_table)
+{
+	epoch_domain_destroy(&hash_table->epoch);
+	free(atomic_load_explicit(&hash_table->current, memory_order_relaxed));
+	pthread_rwlock_destroy(&hash_table->resize_lock);
+	free(hash_table);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* A bucketized cuckoo hash table with the same API as `hash_table_v2`. Every
+   key lives in one of two buckets, picked by two different hash functions,
+   and a bucket is one cache line of four slots. A lookup therefore reads at
+   most two buckets no matter how full the table is, instead of walking a
+   chain. Lookups take no locks, they read optimistically and retry if a
+   writer changed the buckets meanwhile. When an insert can't make room by
+   moving keys to their other bucket, the table doubles in size. Like v1 the
+   table keeps pointers to the caller's keys. */
+struct hash_table_cuckoo;
+struct hash_table_cuckoo *hash_table_cuckoo_create();
+void hash_table_cuckoo_add_entry(struct hash_table_cuckoo *hash_table,
+                                 const char *key,
+                                 uint32_t value);
+bool hash_table_cuckoo_contains(struct hash_table_cuckoo *hash_table,
+                                const char *key);
+uint32_t hash_table_cuckoo_get_value(struct hash_table_cuckoo *hash_table,
+                                     const char* key);
+uint32_t hash_table_cuckoo_resize_count(struct hash_table_cuckoo *hash_table);
+void hash_table_cuckoo_memory_usage(struct hash_table_cuckoo *hash_table,
+                                    struct hash_table_memory_usage *usage);
+void hash_table_cuckoo_destroy(struct hash_table_cuckoo *hash_table);
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "entry-arena.h"
+#include "hash-table-common.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+/* Generates a hash table for one key and value type, the way `sys/queue.h`
+   generates lists. Every function is `static inline` and calls `hash` and
+   `equal` directly, so the compiler can inline them and a table of integers
+   never does any string work. The table works like v2 without removes:
+   writers lock their bucket, readers take no locks and follow links with
+   acquire loads, and entries come from an arena.
+
+     HASH_TABLE_GENERATE(name, key_type, value_type, hash, equal)
+
+   declares `struct name` and
+
+     struct name *name_create(void);
+     void name_add_entry(struct name *, key_type key, value_type value);
+     bool name_contains(struct name *, key_type key);
+     value_type name_get_value(struct name *, key_type key);
+     void name_destroy(struct name *);
+
+   `hash` is a `uint32_t (key_type)` and `equal` a `bool (key_type, key_type)`,
+   keys are passed and stored by value. */
+#define HASH_TABLE_GENERATE(name, key_type, value_type, hash, equal)             \
+                                                                                 \
+struct name##_entry {                                                            \
+	key_type key;                                                            \
+	value_type value;                                                        \
+	SLIST_ENTRY(name##_entry) pointers;                                      \
+};                                                                               \
+                                                                                 \
+SLIST_HEAD(name##_list, name##_entry);                                           \
+                                                                                 \
+struct name##_bucket {                                                           \
+	struct name##_list list_head;                                            \
+	pthread_mutex_t mutex;                                                   \
+};                                                                               \
+                                                                                 \
+struct name {                                                                    \
+	struct name##_bucket buckets[HASH_TABLE_CAPACITY];                       \
+	struct entry_arena arena;                                                \
+};                                                                               \
+                                                                                 \
+static inline struct name *name##_create(void)                                   \
+{                                                                                \
+	struct name *hash_table = aligned_alloc(alignof(struct name),            \
+	                                        sizeof(struct name));            \
+	assert(hash_table != NULL);                                              \
+	memset(hash_table, 0, sizeof(struct name));                              \
+	entry_arena_init(&hash_table->arena, sizeof(struct name##_entry));       \
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {                       \
+		SLIST_INIT(&hash_table->buckets[i].list_head);                   \
+		pthread_mutex_init(&hash_table->buckets[i].mutex, NULL);         \
+	}                                                                        \
+	return hash_table;                                                       \
+}                                                                                \
+                                                                                 \
+static inline struct name##_entry *name##_find(struct name##_bucket *bucket,     \
+                                               key_type key)                     \
+{                                                                                \
+	struct name##_entry *entry =                                             \
+		__atomic_load_n(&SLIST_FIRST(&bucket->list_head), __ATOMIC_ACQUIRE); \
+	while (entry != NULL) {                                                  \
+		if (equal(entry->key, key)) {                                    \
+			return entry;                                            \
+		}                                                                \
+		entry = __atomic_load_n(&SLIST_NEXT(entry, pointers),            \
+		                        __ATOMIC_ACQUIRE);                       \
+	}                                                                        \
+	return NULL;                                                             \
+}                                                                                \
+                                                                                 \
+static inline void name##_add_entry(struct name *hash_table, key_type key,       \
+                                    value_type value)                            \
+{                                                                                \
+	struct name##_bucket *bucket =                                           \
+		&hash_table->buckets[hash(key) % HASH_TABLE_CAPACITY];           \
+	pthread_mutex_lock(&bucket->mutex);                                      \
+	struct name##_entry *entry = name##_find(bucket, key);                   \
+	if (entry != NULL) {                                                     \
+		__atomic_store(&entry->value, &value, __ATOMIC_RELAXED);         \
+		pthread_mutex_unlock(&bucket->mutex);                            \
+		return;                                                          \
+	}                                                                        \
+	entry = entry_arena_alloc(&hash_table->arena);                           \
+	entry->key = key;                                                        \
+	entry->value = value;                                                    \
+	SLIST_NEXT(entry, pointers) = SLIST_FIRST(&bucket->list_head);           \
+	__atomic_store_n(&SLIST_FIRST(&bucket->list_head), entry,                \
+	                 __ATOMIC_RELEASE);                                      \
+	pthread_mutex_unlock(&bucket->mutex);                                    \
+}                                                                                \
+                                                                                 \
+static inline bool name##_contains(struct name *hash_table, key_type key)        \
+{                                                                                \
+	struct name##_bucket *bucket =                                           \
+		&hash_table->buckets[hash(key) % HASH_TABLE_CAPACITY];           \
+	return name##_find(bucket, key) != NULL;                                 \
+}                                                                                \
+                                                                                 \
+static inline value_type name##_get_value(struct name *hash_table, key_type key) \
+{                                                                                \
+	struct name##_bucket *bucket =                                           \
+		&hash_table->buckets[hash(key) % HASH_TABLE_CAPACITY];           \
+	struct name##_entry *entry = name##_find(bucket, key);                   \
+	assert(entry != NULL);                                                   \
+	value_type value;                                                        \
+	__atomic_load(&entry->value, &value, __ATOMIC_RELAXED);                  \
+	return value;                                                            \
+}                                                                                \
+                                                                                 \
+static inline void name##_destroy(struct name *hash_table)                       \
+{                                                                                \
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {                       \
+		pthread_mutex_destroy(&hash_table->buckets[i].mutex);            \
+	}                                                                        \
+	entry_arena_destroy(&hash_table->arena);                                 \
+	free(hash_table);                                                        \
+}
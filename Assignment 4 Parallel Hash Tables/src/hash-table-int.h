@@ -0,0 +1,52 @@
+#pragma once
+
+#include "hash-table-generic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The finalizer of MurmurHash3, every bit of the input affects the bottom
+   bits, which is all the bucket index uses. Consecutive integers would
+   otherwise all land in neighbouring buckets, or the same one. */
+static inline uint32_t u64_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return (uint32_t) key;
+}
+
+static inline bool u64_equal(uint64_t a, uint64_t b)
+{
+	return a == b;
+}
+
+/* A table of `uint64_t` keys. */
+HASH_TABLE_GENERATE(hash_table_u64, uint64_t, uint32_t, u64_hash, u64_equal)
+
+/* A fixed width binary key, such as a UUID or a digest. */
+struct key16 {
+	uint8_t bytes[16];
+};
+
+static inline uint32_t key16_hash(struct key16 key)
+{
+	uint64_t low;
+	uint64_t high;
+	memcpy(&low, key.bytes, sizeof(low));
+	memcpy(&high, key.bytes + sizeof(low), sizeof(high));
+	return u64_hash(low ^ (high * 0x9e3779b97f4a7c15ULL));
+}
+
+static inline bool key16_equal(struct key16 a, struct key16 b)
+{
+	return memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0;
+}
+
+/* A table of 16 byte keys, compared with a fixed size `memcmp` instead of
+   `strcmp`. */
+HASH_TABLE_GENERATE(hash_table_key16, struct key16, uint32_t,
+                    key16_hash, key16_equal)
@@ -0,0 +1,150 @@
+#include "hash-table-lockfree.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Entries are never removed, so once a `list_entry` is reachable from a
+   bucket its `key` and `next` never change. Only the head of each list and
+   the values are shared mutable state. */
+struct list_entry {
+	const char *key;
+	_Atomic uint32_t value;
+	struct list_entry *next;
+};
+
+struct hash_table_entry {
+	struct list_entry *_Atomic head;
+};
+
+struct hash_table_lockfree {
+	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
+};
+
+struct hash_table_lockfree *hash_table_lockfree_create()
+{
+	struct hash_table_lockfree *hash_table = calloc(1, sizeof(struct hash_table_lockfree));
+	assert(hash_table != NULL);
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		atomic_init(&hash_table->entries[i].head, NULL);
+	}
+	return hash_table;
+}
+
+static struct hash_table_entry *get_hash_table_entry(struct hash_table_lockfree *hash_table,
+                                                     const char *key)
+{
+	assert(key != NULL);
+	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	struct hash_table_entry *entry = &hash_table->entries[index];
+	return entry;
+}
+
+/* Searches the list from `first` up to, but not including, `last`. Passing
+   `NULL` for `last` searches the whole list. */
+static struct list_entry *get_list_entry(struct list_entry *first,
+                                         struct list_entry *last,
+                                         const char *key)
+{
+	assert(key != NULL);
+
+	for (struct list_entry *entry = first; entry != last; entry = entry->next) {
+		if (strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+bool hash_table_lockfree_contains(struct hash_table_lockfree *hash_table,
+                                  const char *key)
+{
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct list_entry *head = atomic_load_explicit(&hash_table_entry->head,
+	                                               memory_order_acquire);
+	return get_list_entry(head, NULL, key) != NULL;
+}
+
+/* We search the list, and if the key isn't there we try to swing the head
+   over to a new entry that points at the head we searched from. If the CAS
+   fails another writer got in first, so we only need to search the entries
+   that were added since our last attempt before trying again. */
+void hash_table_lockfree_add_entry(struct hash_table_lockfree *hash_table,
+                                   const char *key,
+                                   uint32_t value)
+{
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct list_entry *head = atomic_load_explicit(&hash_table_entry->head,
+	                                               memory_order_acquire);
+	struct list_entry *searched = NULL;
+	struct list_entry *list_entry = NULL;
+
+	while (true) {
+		struct list_entry *existing = get_list_entry(head, searched, key);
+
+		/* Update the value if it already exists */
+		if (existing != NULL) {
+			atomic_store_explicit(&existing->value, value, memory_order_relaxed);
+			free(list_entry);
+			return;
+		}
+
+		if (list_entry == NULL) {
+			list_entry = calloc(1, sizeof(struct list_entry));
+			assert(list_entry != NULL);
+			list_entry->key = key;
+			atomic_init(&list_entry->value, value);
+		}
+		list_entry->next = head;
+		searched = head;
+
+		if (atomic_compare_exchange_weak_explicit(&hash_table_entry->head,
+		                                          &head,
+		                                          list_entry,
+		                                          memory_order_release,
+		                                          memory_order_acquire)) {
+			return;
+		}
+	}
+}
+
+uint32_t hash_table_lockfree_get_value(struct hash_table_lockfree *hash_table,
+                                       const char *key)
+{
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct list_entry *head = atomic_load_explicit(&hash_table_entry->head,
+	                                               memory_order_acquire);
+	struct list_entry *list_entry = get_list_entry(head, NULL, key);
+	assert(list_entry != NULL);
+	return atomic_load_explicit(&list_entry->value, memory_order_relaxed);
+}
+
+void hash_table_lockfree_memory_usage(struct hash_table_lockfree *hash_table,
+                                      struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->bucket_bytes = sizeof(hash_table->entries);
+	usage->table_bytes = sizeof(struct hash_table_lockfree) - usage->bucket_bytes;
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct list_entry *list_entry = atomic_load(&hash_table->entries[i].head);
+		while (list_entry != NULL) {
+			++usage->keys;
+			usage->entry_bytes += hash_table_heap_bytes(list_entry);
+			list_entry = list_entry->next;
+		}
+	}
+}
+
+void hash_table_lockfree_destroy(struct hash_table_lockfree *hash_table)
+{
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct list_entry *list_entry = hash_table->entries[i].head;
+		while (list_entry != NULL) {
+			struct list_entry *next = list_entry->next;
+			free(list_entry);
+			list_entry = next;
+		}
+	}
+	free(hash_table);
+}
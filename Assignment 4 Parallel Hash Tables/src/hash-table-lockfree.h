@@ -0,0 +1,21 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* A hash table with the same API as `hash_table_v2`, but without any locks.
+   New entries are published by compare-and-swap on the head of the bucket's
+   list, so writers never block each other, even on a hot bucket. */
+struct hash_table_lockfree;
+struct hash_table_lockfree *hash_table_lockfree_create();
+void hash_table_lockfree_add_entry(struct hash_table_lockfree *hash_table,
+                                   const char *key,
+                                   uint32_t value);
+bool hash_table_lockfree_contains(struct hash_table_lockfree *hash_table,
+                                  const char *key);
+uint32_t hash_table_lockfree_get_value(struct hash_table_lockfree *hash_table,
+                                       const char* key);
+void hash_table_lockfree_memory_usage(struct hash_table_lockfree *hash_table,
+                                      struct hash_table_memory_usage *usage);
+void hash_table_lockfree_destroy(struct hash_table_lockfree *hash_table);
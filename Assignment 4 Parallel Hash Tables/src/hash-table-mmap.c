@@ -0,0 +1,359 @@
+#include "hash-table-mmap.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MMAP_MAGIC "PHTMMAP1"
+
+/* We map this much address space up front and grow the file underneath it,
+   so the mapping never moves and entries never need pointers fixed up.
+   It's only address space, nothing is allocated until the file grows. */
+#define RESERVE_BYTES ((size_t) 1 << 36)
+
+/* The file grows by at least this much at a time. */
+#define MIN_GROWTH (1024 * 1024)
+
+#define ENTRY_ALIGNMENT 8
+
+/* An offset of 0 is the header, so no entry can have it and it works as
+   the end of a list. */
+struct file_header {
+	char magic[8];
+	uint32_t capacity;
+	uint32_t reserved;
+	/* Where the next entry goes. It can be ahead of the entries that are
+	   reachable if a process died in the middle of an insert, or past the
+	   end of the file if an insert couldn't grow it, that space just stays
+	   unused. */
+	_Atomic uint64_t used;
+	_Atomic uint64_t size;
+	_Atomic uint64_t buckets[HASH_TABLE_CAPACITY];
+};
+
+/* Only ever added, an entry never moves or goes away. The key follows the
+   entry, NUL-terminated. */
+struct file_entry {
+	_Atomic uint64_t next;
+	uint32_t hash;
+	_Atomic uint32_t value;
+	char key[];
+};
+
+/* The locks only protect writers of this process from each other, so they
+   live in our memory and never in the file. */
+struct hash_table_mmap {
+	int fd;
+	char *base;
+	/* How big the file is, only written under `grow_mutex`. */
+	_Atomic size_t file_bytes;
+	pthread_mutex_t grow_mutex;
+	pthread_mutex_t mutexes[HASH_TABLE_CAPACITY];
+};
+
+static struct file_header *get_header(struct hash_table_mmap *hash_table)
+{
+	return (struct file_header *) hash_table->base;
+}
+
+static struct file_entry *get_entry(struct hash_table_mmap *hash_table,
+                                    uint64_t offset)
+{
+	return (struct file_entry *) (hash_table->base + offset);
+}
+
+static size_t align_up(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+/* A file we didn't just create has to look like ours before we follow any
+   offset in it. */
+static bool check_header(const struct file_header *header)
+{
+	return memcmp(header->magic, MMAP_MAGIC, sizeof(header->magic)) == 0
+	       && header->capacity == HASH_TABLE_CAPACITY
+	       && atomic_load(&header->used) >= sizeof(struct file_header)
+	       && atomic_load(&header->used) <= RESERVE_BYTES;
+}
+
+/* Lookups follow offsets without checking them, so every entry reachable
+   from a bucket has to be inside `end`, with its key ending before `end`
+   and in the bucket its hash says. An entry always points at one that was
+   added before it, at a lower offset, so a list can't loop back on itself.
+   This reads every entry once, a truncated or corrupt file fails the open
+   instead of a lookup. */
+static bool check_entries(const char *base, uint64_t end)
+{
+	const struct file_header *header = (const struct file_header *) base;
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		uint64_t limit = end;
+		uint64_t offset = atomic_load(&header->buckets[i]);
+		while (offset != 0) {
+			if (offset < sizeof(struct file_header)
+			    || offset % ENTRY_ALIGNMENT != 0
+			    || offset >= limit
+			    || limit - offset <= sizeof(struct file_entry)) {
+				return false;
+			}
+			const struct file_entry *entry
+				= (const struct file_entry *) (base + offset);
+			size_t key_room = end - offset - sizeof(struct file_entry);
+			if (memchr(entry->key, 0, key_room) == NULL
+			    || entry->hash % HASH_TABLE_CAPACITY != i
+			    || bernstein_hash(entry->key) != entry->hash) {
+				return false;
+			}
+			limit = offset;
+			offset = atomic_load(&entry->next);
+		}
+	}
+	return true;
+}
+
+static struct hash_table_mmap *fail(int fd, void *base, int error)
+{
+	if (base != NULL) {
+		munmap(base, RESERVE_BYTES);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	errno = error;
+	return NULL;
+}
+
+struct hash_table_mmap *hash_table_mmap_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		return fail(fd, NULL, errno);
+	}
+	struct stat stat;
+	if (fstat(fd, &stat) != 0) {
+		return fail(fd, NULL, errno);
+	}
+
+	size_t file_bytes = stat.st_size;
+	bool created = file_bytes == 0;
+	if (created) {
+		file_bytes = align_up(sizeof(struct file_header), MIN_GROWTH);
+		if (ftruncate(fd, file_bytes) != 0) {
+			return fail(fd, NULL, errno);
+		}
+	}
+	else if (file_bytes < sizeof(struct file_header) || file_bytes > RESERVE_BYTES) {
+		return fail(fd, NULL, EINVAL);
+	}
+
+	/* Touching the mapping past the end of the file would be SIGBUS, we
+	   never do until the file has grown to cover it. */
+	void *base = mmap(NULL, RESERVE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                  fd, 0);
+	if (base == MAP_FAILED) {
+		return fail(fd, NULL, errno);
+	}
+
+	struct file_header *header = base;
+	if (created) {
+		/* The file came from `ftruncate`, so everything else is already
+		   zero, which is an empty table */
+		memcpy(header->magic, MMAP_MAGIC, sizeof(header->magic));
+		header->capacity = HASH_TABLE_CAPACITY;
+		atomic_store(&header->used, sizeof(struct file_header));
+	}
+	else if (!check_header(header)) {
+		return fail(fd, base, EINVAL);
+	}
+	else {
+		uint64_t used = atomic_load(&header->used);
+		if (!check_entries(base, used < file_bytes ? used : file_bytes)) {
+			return fail(fd, base, EINVAL);
+		}
+	}
+
+	struct hash_table_mmap *hash_table = malloc(sizeof(struct hash_table_mmap));
+	assert(hash_table != NULL);
+	hash_table->fd = fd;
+	hash_table->base = base;
+	atomic_init(&hash_table->file_bytes, file_bytes);
+	pthread_mutex_init(&hash_table->grow_mutex, NULL);
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		pthread_mutex_init(&hash_table->mutexes[i], NULL);
+	}
+	return hash_table;
+}
+
+/* Makes sure the file covers everything up to `end`, at least doubling it so
+   we rarely get here. Returns false and sets `errno` if the file can't get
+   that big, `EFBIG` if it would outgrow our mapping. If doubling fails we
+   still try for just enough. */
+static bool grow(struct hash_table_mmap *hash_table, size_t end)
+{
+	if (end > RESERVE_BYTES) {
+		errno = EFBIG;
+		return false;
+	}
+	bool grown = true;
+	pthread_mutex_lock(&hash_table->grow_mutex);
+	size_t file_bytes = atomic_load(&hash_table->file_bytes);
+	if (end > file_bytes) {
+		size_t new_bytes = file_bytes * 2;
+		if (new_bytes < end) {
+			new_bytes = align_up(end, MIN_GROWTH);
+		}
+		if (new_bytes > RESERVE_BYTES) {
+			new_bytes = RESERVE_BYTES;
+		}
+		if (ftruncate(hash_table->fd, new_bytes) != 0) {
+			new_bytes = align_up(end, ENTRY_ALIGNMENT);
+			grown = ftruncate(hash_table->fd, new_bytes) == 0;
+		}
+		if (grown) {
+			atomic_store(&hash_table->file_bytes, new_bytes);
+		}
+	}
+	pthread_mutex_unlock(&hash_table->grow_mutex);
+	return grown;
+}
+
+/* Space is handed out by bumping `used`, which doesn't need a lock. If the
+   file can't grow to cover it we hand the space back, unless someone
+   allocated after us, then it stays unused. */
+static bool allocate(struct hash_table_mmap *hash_table, size_t bytes,
+                     uint64_t *offset)
+{
+	struct file_header *header = get_header(hash_table);
+	bytes = align_up(bytes, ENTRY_ALIGNMENT);
+	uint64_t start = atomic_fetch_add(&header->used, bytes);
+	if (start + bytes > atomic_load(&hash_table->file_bytes)
+	    && !grow(hash_table, start + bytes)) {
+		int error = errno;
+		uint64_t end = start + bytes;
+		atomic_compare_exchange_strong(&header->used, &end, start);
+		errno = error;
+		return false;
+	}
+	*offset = start;
+	return true;
+}
+
+static struct file_entry *get_list_entry(struct hash_table_mmap *hash_table,
+                                         uint32_t bucket,
+                                         const char *key,
+                                         uint32_t hash)
+{
+	struct file_header *header = get_header(hash_table);
+	uint64_t offset = atomic_load_explicit(&header->buckets[bucket],
+	                                       memory_order_acquire);
+	while (offset != 0) {
+		struct file_entry *entry = get_entry(hash_table, offset);
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+		offset = atomic_load_explicit(&entry->next, memory_order_acquire);
+	}
+	return NULL;
+}
+
+bool hash_table_mmap_contains(struct hash_table_mmap *hash_table,
+                              const char *key)
+{
+	assert(key != NULL);
+	uint32_t hash = bernstein_hash(key);
+	return get_list_entry(hash_table, hash % HASH_TABLE_CAPACITY, key, hash) != NULL;
+}
+
+/* Like v2 the entry is filled in before a release store makes it
+   reachable, so readers without the lock see all of it. */
+bool hash_table_mmap_add_entry(struct hash_table_mmap *hash_table,
+                               const char *key,
+                               uint32_t value)
+{
+	assert(key != NULL);
+	struct file_header *header = get_header(hash_table);
+	uint32_t hash = bernstein_hash(key);
+	uint32_t bucket = hash % HASH_TABLE_CAPACITY;
+
+	pthread_mutex_lock(&hash_table->mutexes[bucket]);
+	struct file_entry *list_entry = get_list_entry(hash_table, bucket, key, hash);
+
+	/* Update the value if it already exists */
+	if (list_entry != NULL) {
+		atomic_store_explicit(&list_entry->value, value, memory_order_relaxed);
+		pthread_mutex_unlock(&hash_table->mutexes[bucket]);
+		return true;
+	}
+
+	size_t key_bytes = strlen(key) + 1;
+	uint64_t offset;
+	if (!allocate(hash_table, sizeof(struct file_entry) + key_bytes, &offset)) {
+		int error = errno;
+		pthread_mutex_unlock(&hash_table->mutexes[bucket]);
+		errno = error;
+		return false;
+	}
+	list_entry = get_entry(hash_table, offset);
+	list_entry->hash = hash;
+	atomic_store_explicit(&list_entry->value, value, memory_order_relaxed);
+	memcpy(list_entry->key, key, key_bytes);
+	atomic_store_explicit(&list_entry->next,
+	                      atomic_load_explicit(&header->buckets[bucket],
+	                                           memory_order_relaxed),
+	                      memory_order_relaxed);
+	atomic_store_explicit(&header->buckets[bucket], offset, memory_order_release);
+	pthread_mutex_unlock(&hash_table->mutexes[bucket]);
+
+	atomic_fetch_add_explicit(&header->size, 1, memory_order_relaxed);
+	return true;
+}
+
+uint32_t hash_table_mmap_get_value(struct hash_table_mmap *hash_table,
+                                   const char *key)
+{
+	assert(key != NULL);
+	uint32_t hash = bernstein_hash(key);
+	struct file_entry *list_entry = get_list_entry(hash_table,
+	                                               hash % HASH_TABLE_CAPACITY,
+	                                               key, hash);
+	assert(list_entry != NULL);
+	return atomic_load_explicit(&list_entry->value, memory_order_relaxed);
+}
+
+size_t hash_table_mmap_size(struct hash_table_mmap *hash_table)
+{
+	return atomic_load(&get_header(hash_table)->size);
+}
+
+size_t hash_table_mmap_bytes(struct hash_table_mmap *hash_table)
+{
+	return atomic_load(&get_header(hash_table)->used);
+}
+
+bool hash_table_mmap_sync(struct hash_table_mmap *hash_table)
+{
+	size_t file_bytes = atomic_load(&hash_table->file_bytes);
+	return msync(hash_table->base, file_bytes, MS_SYNC) == 0;
+}
+
+void hash_table_mmap_close(struct hash_table_mmap *hash_table)
+{
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		pthread_mutex_destroy(&hash_table->mutexes[i]);
+	}
+	pthread_mutex_destroy(&hash_table->grow_mutex);
+	munmap(hash_table->base, RESERVE_BYTES);
+	close(hash_table->fd);
+	free(hash_table);
+}
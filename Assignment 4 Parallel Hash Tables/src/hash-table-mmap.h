@@ -0,0 +1,38 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A hash table that lives in a file. Buckets and entries are in a shared
+   mapping of the file and point at each other with offsets from its start,
+   so opening the file again gives back the same table without rebuilding
+   anything. Opening checks every entry once, so a damaged file is turned
+   away rather than read past its end. Only one process can have a file
+   open at a time. Keys are copied into the file, and like v2 lookups take
+   no locks. */
+struct hash_table_mmap;
+
+/* Opens the table in `path`, creating an empty one if the file doesn't
+   exist. Returns `NULL` and sets `errno` if it can't, `EINVAL` if the file
+   isn't one of our tables or is truncated or corrupt, and `EWOULDBLOCK` if
+   another process has it open. */
+struct hash_table_mmap *hash_table_mmap_open(const char *path);
+/* Returns false and sets `errno` if the file couldn't grow to fit the
+   entry, the table is left as it was. */
+bool hash_table_mmap_add_entry(struct hash_table_mmap *hash_table,
+                               const char *key,
+                               uint32_t value);
+bool hash_table_mmap_contains(struct hash_table_mmap *hash_table,
+                              const char *key);
+uint32_t hash_table_mmap_get_value(struct hash_table_mmap *hash_table,
+                                   const char *key);
+size_t hash_table_mmap_size(struct hash_table_mmap *hash_table);
+/* Returns how many bytes of the file are in use. */
+size_t hash_table_mmap_bytes(struct hash_table_mmap *hash_table);
+/* Waits until everything written so far is on disk. Returns false and
+   sets `errno` if it couldn't be. */
+bool hash_table_mmap_sync(struct hash_table_mmap *hash_table);
+/* Unmaps the file, the table stays in it. Nothing has to be in progress. */
+void hash_table_mmap_close(struct hash_table_mmap *hash_table);
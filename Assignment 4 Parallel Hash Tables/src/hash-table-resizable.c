@@ -0,0 +1,352 @@
+#include "hash-table-resizable.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
+
+/* We start a resize once there are this many entries per bucket on
+   average. */
+#define MAX_LOAD_FACTOR 2
+
+/* Every write during a resize moves this many buckets to the new array. */
+#define MIGRATE_BATCH 8
+
+/* We keep the full hash with every entry so moving it to a bigger array
+   doesn't have to hash the key again. */
+struct list_entry {
+	const char *key;
+	uint32_t hash;
+	uint32_t value;
+	SLIST_ENTRY(list_entry) pointers;
+};
+
+SLIST_HEAD(list_head, list_entry);
+
+/* Once all the entries of a bucket are moved to the next array, `moved` is
+   set and the bucket stays empty for good. */
+struct hash_table_entry {
+	struct list_head list_head;
+	pthread_mutex_t mutex;
+	bool moved;
+};
+
+/* While a resize is in progress `previous` points at the array we're moving
+   entries out of. A key always lives in the oldest bucket for it that isn't
+   `moved` yet. We never start another resize until `previous` is done, so
+   there are at most two arrays to look at. */
+struct bucket_array {
+	size_t capacity;
+	struct bucket_array *_Atomic previous;
+	_Atomic size_t next_to_migrate;
+	_Atomic size_t migrated;
+	/* Arrays we are done with are kept in a list until the table is
+	   destroyed, since other threads may still be looking at them. */
+	struct bucket_array *retired;
+	struct hash_table_entry entries[];
+};
+
+struct hash_table_resizable {
+	struct bucket_array *_Atomic current;
+	_Atomic size_t size;
+	_Atomic uint32_t resize_count;
+	pthread_mutex_t resize_mutex;
+	struct bucket_array *retired;
+};
+
+static size_t bucket_array_bytes(size_t capacity)
+{
+	return sizeof(struct bucket_array)
+	       + capacity * sizeof(struct hash_table_entry);
+}
+
+/* Allocating the next array happens in the middle of an insert, so we don't
+   want to touch every bucket here. An empty SLIST and an initialized mutex
+   are both all zero bytes, so fresh anonymous memory is already a valid
+   array. We map it directly rather than using `calloc`, which may have to
+   clear recycled heap memory, and the pages get faulted in lazily by the
+   operations that use them. */
+static struct bucket_array *bucket_array_create(size_t capacity,
+                                                struct bucket_array *previous)
+{
+	struct bucket_array *array = mmap(NULL, bucket_array_bytes(capacity),
+	                                  PROT_READ | PROT_WRITE,
+	                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(array != MAP_FAILED);
+	array->capacity = capacity;
+	atomic_init(&array->previous, previous);
+	atomic_init(&array->next_to_migrate, 0);
+	atomic_init(&array->migrated, 0);
+	return array;
+}
+
+static void bucket_array_destroy(struct bucket_array *array)
+{
+	for (size_t i = 0; i < array->capacity; ++i) {
+		struct hash_table_entry *entry = &array->entries[i];
+		struct list_head *list_head = &entry->list_head;
+		struct list_entry *list_entry = NULL;
+		while (!SLIST_EMPTY(list_head)) {
+			list_entry = SLIST_FIRST(list_head);
+			SLIST_REMOVE_HEAD(list_head, pointers);
+			free(list_entry);
+		}
+		pthread_mutex_destroy(&entry->mutex);
+	}
+	munmap(array, bucket_array_bytes(array->capacity));
+}
+
+struct hash_table_resizable *hash_table_resizable_create()
+{
+	static const pthread_mutex_t initializer = PTHREAD_MUTEX_INITIALIZER;
+	static const pthread_mutex_t zero;
+	assert(memcmp(&initializer, &zero, sizeof(pthread_mutex_t)) == 0);
+	(void) initializer;
+	(void) zero;
+
+	struct hash_table_resizable *hash_table = calloc(1, sizeof(struct hash_table_resizable));
+	assert(hash_table != NULL);
+	atomic_init(&hash_table->current,
+	            bucket_array_create(HASH_TABLE_CAPACITY, NULL));
+	atomic_init(&hash_table->size, 0);
+	atomic_init(&hash_table->resize_count, 0);
+	pthread_mutex_init(&hash_table->resize_mutex, NULL);
+	return hash_table;
+}
+
+/* Returns the bucket the key lives in, locked. If the array we read gets
+   replaced and our bucket moved before we locked it, we start over from the
+   new current array. */
+static struct hash_table_entry *lock_hash_table_entry(struct hash_table_resizable *hash_table,
+                                                      uint32_t hash,
+                                                      struct bucket_array **array_out)
+{
+	while (true) {
+		struct bucket_array *array = atomic_load_explicit(&hash_table->current,
+		                                                  memory_order_acquire);
+		struct bucket_array *previous = atomic_load_explicit(&array->previous,
+		                                                     memory_order_acquire);
+		struct hash_table_entry *entry;
+		if (previous != NULL) {
+			entry = &previous->entries[hash % previous->capacity];
+			pthread_mutex_lock(&entry->mutex);
+			if (!entry->moved) {
+				*array_out = array;
+				return entry;
+			}
+			pthread_mutex_unlock(&entry->mutex);
+		}
+		entry = &array->entries[hash % array->capacity];
+		pthread_mutex_lock(&entry->mutex);
+		if (!entry->moved) {
+			*array_out = array;
+			return entry;
+		}
+		pthread_mutex_unlock(&entry->mutex);
+	}
+}
+
+static struct list_entry *get_list_entry(struct list_head *list_head,
+                                         const char *key,
+                                         uint32_t hash)
+{
+	assert(key != NULL);
+
+	struct list_entry *entry = NULL;
+
+	SLIST_FOREACH(entry, list_head, pointers) {
+		if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Moves every entry in bucket `index` of `previous` into `array`. Until we
+   set `moved` every operation on these keys waits on the old bucket's lock,
+   so nobody else can be using the buckets we move entries into. */
+static void migrate_bucket(struct bucket_array *array,
+                           struct bucket_array *previous,
+                           size_t index)
+{
+	struct hash_table_entry *old_entry = &previous->entries[index];
+	pthread_mutex_lock(&old_entry->mutex);
+	struct list_head *old_head = &old_entry->list_head;
+	while (!SLIST_EMPTY(old_head)) {
+		struct list_entry *list_entry = SLIST_FIRST(old_head);
+		SLIST_REMOVE_HEAD(old_head, pointers);
+		struct hash_table_entry *new_entry =
+			&array->entries[list_entry->hash % array->capacity];
+		SLIST_INSERT_HEAD(&new_entry->list_head, list_entry, pointers);
+	}
+	old_entry->moved = true;
+	pthread_mutex_unlock(&old_entry->mutex);
+}
+
+/* Claims the next few buckets of an in-progress resize and moves them. The
+   thread that moves the last bucket retires the old array. */
+static void help_migrate(struct hash_table_resizable *hash_table,
+                         struct bucket_array *array)
+{
+	struct bucket_array *previous = atomic_load_explicit(&array->previous,
+	                                                     memory_order_acquire);
+	if (previous == NULL) {
+		return;
+	}
+
+	size_t start = atomic_fetch_add(&array->next_to_migrate, MIGRATE_BATCH);
+	if (start >= previous->capacity) {
+		return;
+	}
+	size_t end = start + MIGRATE_BATCH;
+	if (end > previous->capacity) {
+		end = previous->capacity;
+	}
+	for (size_t i = start; i < end; ++i) {
+		migrate_bucket(array, previous, i);
+	}
+
+	size_t migrated = atomic_fetch_add(&array->migrated, end - start) + (end - start);
+	if (migrated == previous->capacity) {
+		pthread_mutex_lock(&hash_table->resize_mutex);
+		previous->retired = hash_table->retired;
+		hash_table->retired = previous;
+		atomic_store_explicit(&array->previous, NULL, memory_order_release);
+		pthread_mutex_unlock(&hash_table->resize_mutex);
+	}
+}
+
+/* Installs an array with double the capacity. Only one resize happens at a
+   time; if another thread is already starting one, we just carry on. */
+static void maybe_resize(struct hash_table_resizable *hash_table, size_t size)
+{
+	if (pthread_mutex_trylock(&hash_table->resize_mutex) != 0) {
+		return;
+	}
+	struct bucket_array *array = atomic_load_explicit(&hash_table->current,
+	                                                  memory_order_acquire);
+	if (atomic_load_explicit(&array->previous, memory_order_acquire) == NULL
+	    && size > array->capacity * MAX_LOAD_FACTOR) {
+		struct bucket_array *bigger = bucket_array_create(array->capacity * 2, array);
+		atomic_store_explicit(&hash_table->current, bigger, memory_order_release);
+		atomic_fetch_add(&hash_table->resize_count, 1);
+	}
+	pthread_mutex_unlock(&hash_table->resize_mutex);
+}
+
+bool hash_table_resizable_contains(struct hash_table_resizable *hash_table,
+                                   const char *key)
+{
+	uint32_t hash = bernstein_hash(key);
+	struct bucket_array *array;
+	struct hash_table_entry *hash_table_entry = lock_hash_table_entry(hash_table, hash, &array);
+	struct list_entry *list_entry = get_list_entry(&hash_table_entry->list_head, key, hash);
+	pthread_mutex_unlock(&hash_table_entry->mutex);
+	return list_entry != NULL;
+}
+
+void hash_table_resizable_add_entry(struct hash_table_resizable *hash_table,
+                                    const char *key,
+                                    uint32_t value)
+{
+	uint32_t hash = bernstein_hash(key);
+	struct bucket_array *array;
+	struct hash_table_entry *hash_table_entry = lock_hash_table_entry(hash_table, hash, &array);
+	struct list_head *list_head = &hash_table_entry->list_head;
+	struct list_entry *list_entry = get_list_entry(list_head, key, hash);
+
+	/* Update the value if it already exists */
+	if (list_entry != NULL) {
+		list_entry->value = value;
+		pthread_mutex_unlock(&hash_table_entry->mutex);
+		help_migrate(hash_table, array);
+		return;
+	}
+
+	list_entry = calloc(1, sizeof(struct list_entry));
+	assert(list_entry != NULL);
+	list_entry->key = key;
+	list_entry->hash = hash;
+	list_entry->value = value;
+	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+	pthread_mutex_unlock(&hash_table_entry->mutex);
+
+	help_migrate(hash_table, array);
+	size_t size = atomic_fetch_add(&hash_table->size, 1) + 1;
+	if (size > array->capacity * MAX_LOAD_FACTOR) {
+		maybe_resize(hash_table, size);
+	}
+}
+
+uint32_t hash_table_resizable_get_value(struct hash_table_resizable *hash_table,
+                                        const char *key)
+{
+	uint32_t hash = bernstein_hash(key);
+	struct bucket_array *array;
+	struct hash_table_entry *hash_table_entry = lock_hash_table_entry(hash_table, hash, &array);
+	struct list_entry *list_entry = get_list_entry(&hash_table_entry->list_head, key, hash);
+	assert(list_entry != NULL);
+	uint32_t value = list_entry->value;
+	pthread_mutex_unlock(&hash_table_entry->mutex);
+	return value;
+}
+
+uint32_t hash_table_resizable_resize_count(struct hash_table_resizable *hash_table)
+{
+	return atomic_load(&hash_table->resize_count);
+}
+
+static void add_array_usage(struct bucket_array *array,
+                            struct hash_table_memory_usage *usage)
+{
+	usage->bucket_bytes += bucket_array_bytes(array->capacity)
+	                       - array->capacity * sizeof(pthread_mutex_t);
+	usage->lock_bytes += array->capacity * sizeof(pthread_mutex_t);
+	for (size_t i = 0; i < array->capacity; ++i) {
+		struct list_entry *list_entry = NULL;
+		SLIST_FOREACH(list_entry, &array->entries[i].list_head, pointers) {
+			++usage->keys;
+			usage->entry_bytes += hash_table_heap_bytes(list_entry);
+		}
+	}
+}
+
+/* Arrays that were replaced stay around until the table is destroyed, so
+   they count too. Their entries have all moved on, but they still hold the
+   pages of their buckets. */
+void hash_table_resizable_memory_usage(struct hash_table_resizable *hash_table,
+                                       struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->table_bytes = sizeof(struct hash_table_resizable);
+	struct bucket_array *array = atomic_load(&hash_table->current);
+	struct bucket_array *previous = atomic_load(&array->previous);
+	if (previous != NULL) {
+		add_array_usage(previous, usage);
+	}
+	add_array_usage(array, usage);
+	for (struct bucket_array *retired = hash_table->retired; retired != NULL;
+	     retired = retired->retired) {
+		add_array_usage(retired, usage);
+	}
+}
+
+void hash_table_resizable_destroy(struct hash_table_resizable *hash_table)
+{
+	struct bucket_array *array = atomic_load(&hash_table->current);
+	struct bucket_array *previous = atomic_load(&array->previous);
+	if (previous != NULL) {
+		bucket_array_destroy(previous);
+	}
+	bucket_array_destroy(array);
+	while (hash_table->retired != NULL) {
+		struct bucket_array *retired = hash_table->retired;
+		hash_table->retired = retired->retired;
+		bucket_array_destroy(retired);
+	}
+	pthread_mutex_destroy(&hash_table->resize_mutex);
+	free(hash_table);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* A hash table that starts with `HASH_TABLE_CAPACITY` buckets and doubles
+   whenever the average chain length grows past a threshold. Entries are
+   moved to the new buckets a few at a time by later writers, so no single
+   operation has to rehash the whole table. */
+struct hash_table_resizable;
+struct hash_table_resizable *hash_table_resizable_create();
+void hash_table_resizable_add_entry(struct hash_table_resizable *hash_table,
+                                    const char *key,
+                                    uint32_t value);
+bool hash_table_resizable_contains(struct hash_table_resizable *hash_table,
+                                   const char *key);
+uint32_t hash_table_resizable_get_value(struct hash_table_resizable *hash_table,
+                                        const char* key);
+/* Returns how many times the table has doubled its capacity. */
+uint32_t hash_table_resizable_resize_count(struct hash_table_resizable *hash_table);
+void hash_table_resizable_memory_usage(struct hash_table_resizable *hash_table,
+                                       struct hash_table_memory_usage *usage);
+void hash_table_resizable_destroy(struct hash_table_resizable *hash_table);
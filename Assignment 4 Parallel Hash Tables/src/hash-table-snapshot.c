@@ -0,0 +1,278 @@
+#include "hash-table-snapshot.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "PHTSNAP1"
+
+#define HASH_NAME_SIZE 16
+
+struct snapshot_header {
+	char magic[8];
+	char hash_name[HASH_NAME_SIZE];
+	/* Always a power of two, so a bucket is just the bottom bits. */
+	uint32_t bucket_count;
+	uint32_t reserved;
+	uint64_t entry_count;
+	uint64_t keys_bytes;
+};
+
+struct snapshot_entry {
+	uint32_t hash;
+	uint32_t value;
+	/* From the start of the keys. */
+	uint64_t key_offset;
+};
+
+struct hash_table_snapshot {
+	void *mapping;
+	size_t bytes;
+	hash_function *hash;
+	uint32_t bucket_mask;
+	size_t entry_count;
+	size_t keys_bytes;
+	const uint64_t *buckets;
+	const struct snapshot_entry *entries;
+	const char *keys;
+};
+
+/* About one entry per bucket. */
+static uint32_t get_bucket_count(size_t count)
+{
+	uint32_t bucket_count = 1;
+	while (bucket_count < count && bucket_count < (UINT32_C(1) << 31)) {
+		bucket_count *= 2;
+	}
+	return bucket_count;
+}
+
+static size_t snapshot_bytes(uint32_t bucket_count, uint64_t entry_count,
+                             uint64_t keys_bytes)
+{
+	return sizeof(struct snapshot_header)
+	       + (bucket_count + 1) * sizeof(uint64_t)
+	       + entry_count * sizeof(struct snapshot_entry)
+	       + keys_bytes;
+}
+
+bool hash_table_snapshot_write(const char *path,
+                               hash_function *hash,
+                               const char *const *keys,
+                               const uint32_t *values,
+                               size_t count)
+{
+	const char *hash_name = hash_function_name(hash);
+	if (hash_name == NULL || strlen(hash_name) >= HASH_NAME_SIZE) {
+		errno = EINVAL;
+		return false;
+	}
+
+	struct snapshot_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	strcpy(header.hash_name, hash_name);
+	header.bucket_count = get_bucket_count(count);
+	header.entry_count = count;
+
+	/* A counting sort by bucket, like `hash_table_v2_add_batch` does */
+	uint32_t mask = header.bucket_count - 1;
+	uint64_t *buckets = calloc(header.bucket_count + 1, sizeof(uint64_t));
+	struct snapshot_entry *entries = malloc(count * sizeof(struct snapshot_entry));
+	uint32_t *hashes = malloc(count * sizeof(uint32_t));
+	assert(buckets != NULL && (count == 0 || (entries != NULL && hashes != NULL)));
+	for (size_t i = 0; i < count; ++i) {
+		hashes[i] = hash(keys[i]);
+		++buckets[(hashes[i] & mask) + 1];
+	}
+	for (uint32_t i = 0; i < header.bucket_count; ++i) {
+		buckets[i + 1] += buckets[i];
+	}
+	uint64_t *next = malloc(header.bucket_count * sizeof(uint64_t));
+	assert(next != NULL);
+	memcpy(next, buckets, header.bucket_count * sizeof(uint64_t));
+	uint64_t key_offset = 0;
+	for (size_t i = 0; i < count; ++i) {
+		struct snapshot_entry *entry = &entries[next[hashes[i] & mask]++];
+		entry->hash = hashes[i];
+		entry->value = values[i];
+		entry->key_offset = key_offset;
+		key_offset += strlen(keys[i]) + 1;
+	}
+	header.keys_bytes = key_offset;
+	free(next);
+	free(hashes);
+
+	size_t path_length = strlen(path);
+	char *temporary = malloc(path_length + sizeof(".tmp"));
+	assert(temporary != NULL);
+	memcpy(temporary, path, path_length);
+	memcpy(temporary + path_length, ".tmp", sizeof(".tmp"));
+
+	bool written = false;
+	FILE *file = fopen(temporary, "wb");
+	if (file != NULL) {
+		written = fwrite(&header, sizeof(header), 1, file) == 1
+		          && fwrite(buckets, sizeof(uint64_t), header.bucket_count + 1, file)
+		             == header.bucket_count + 1
+		          && fwrite(entries, sizeof(struct snapshot_entry), count, file) == count;
+		/* The keys go in the same order as the pairs we were given */
+		for (size_t i = 0; written && i < count; ++i) {
+			written = fputs(keys[i], file) != EOF && fputc(0, file) != EOF;
+		}
+		int saved_errno = errno;
+		if (fclose(file) != 0 && written) {
+			written = false;
+			saved_errno = errno;
+		}
+		if (written && rename(temporary, path) != 0) {
+			written = false;
+			saved_errno = errno;
+		}
+		if (!written) {
+			unlink(temporary);
+		}
+		errno = saved_errno;
+	}
+
+	free(temporary);
+	free(buckets);
+	free(entries);
+	return written;
+}
+
+/* We only check what is cheap when opening: the header, and that the file
+   ends with a NUL. Lookups ignore bucket and key offsets that point outside
+   the file, so a corrupt snapshot gives wrong answers instead of reading
+   memory it shouldn't.
+
+   Everything in the header has to agree with the size of the file before we
+   trust any offset in it. */
+static bool check_header(const struct snapshot_header *header, size_t bytes)
+{
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+	    || memchr(header->hash_name, 0, HASH_NAME_SIZE) == NULL
+	    || header->bucket_count == 0
+	    || (header->bucket_count & (header->bucket_count - 1)) != 0
+	    || header->entry_count > bytes / sizeof(struct snapshot_entry)
+	    || header->keys_bytes > bytes) {
+		return false;
+	}
+	if (snapshot_bytes(header->bucket_count, header->entry_count,
+	                   header->keys_bytes) != bytes) {
+		return false;
+	}
+	/* So `strcmp` on the last key can't run off the end of the file */
+	const char *last = (const char *) header + bytes - 1;
+	return header->keys_bytes == 0 || *last == 0;
+}
+
+struct hash_table_snapshot *hash_table_snapshot_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat stat;
+	if (fstat(fd, &stat) != 0) {
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return NULL;
+	}
+	size_t bytes = stat.st_size;
+	if (bytes < sizeof(struct snapshot_header)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	void *mapping = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	int saved_errno = errno;
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		errno = saved_errno;
+		return NULL;
+	}
+
+	const struct snapshot_header *header = mapping;
+	hash_function *hash = NULL;
+	if (check_header(header, bytes)) {
+		hash = hash_function_find(header->hash_name);
+	}
+	if (hash == NULL) {
+		munmap(mapping, bytes);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct hash_table_snapshot *snapshot = malloc(sizeof(struct hash_table_snapshot));
+	assert(snapshot != NULL);
+	snapshot->mapping = mapping;
+	snapshot->bytes = bytes;
+	snapshot->hash = hash;
+	snapshot->bucket_mask = header->bucket_count - 1;
+	snapshot->entry_count = header->entry_count;
+	snapshot->keys_bytes = header->keys_bytes;
+	snapshot->buckets = (const uint64_t *) (header + 1);
+	snapshot->entries = (const struct snapshot_entry *) (snapshot->buckets
+	                                                     + header->bucket_count + 1);
+	snapshot->keys = (const char *) (snapshot->entries + header->entry_count);
+	return snapshot;
+}
+
+static const struct snapshot_entry *get_entry(struct hash_table_snapshot *snapshot,
+                                              const char *key)
+{
+	assert(key != NULL);
+	uint32_t hash = snapshot->hash(key);
+	uint32_t bucket = hash & snapshot->bucket_mask;
+	uint64_t end = snapshot->buckets[bucket + 1];
+	if (end > snapshot->entry_count) {
+		return NULL;
+	}
+	for (uint64_t i = snapshot->buckets[bucket]; i < end; ++i) {
+		const struct snapshot_entry *entry = &snapshot->entries[i];
+		if (entry->hash == hash
+		    && entry->key_offset < snapshot->keys_bytes
+		    && strcmp(snapshot->keys + entry->key_offset, key) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+bool hash_table_snapshot_contains(struct hash_table_snapshot *snapshot,
+                                  const char *key)
+{
+	return get_entry(snapshot, key) != NULL;
+}
+
+uint32_t hash_table_snapshot_get_value(struct hash_table_snapshot *snapshot,
+                                       const char *key)
+{
+	const struct snapshot_entry *entry = get_entry(snapshot, key);
+	assert(entry != NULL);
+	return entry->value;
+}
+
+size_t hash_table_snapshot_size(struct hash_table_snapshot *snapshot)
+{
+	return snapshot->entry_count;
+}
+
+size_t hash_table_snapshot_bytes(struct hash_table_snapshot *snapshot)
+{
+	return snapshot->bytes;
+}
+
+void hash_table_snapshot_close(struct hash_table_snapshot *snapshot)
+{
+	munmap(snapshot->mapping, snapshot->bytes);
+	free(snapshot);
+}
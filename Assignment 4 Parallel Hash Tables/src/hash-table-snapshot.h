@@ -0,0 +1,39 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A read-only hash table mapped straight from a file written by
+   `hash_table_snapshot_write` (or `hash_table_v2_snapshot`). Opening one
+   doesn't read or copy anything, lookups hash the key and compare against
+   the keys in the mapping, and pages get faulted in as lookups touch them.
+   The file is in the byte order of the machine that wrote it.
+
+   The file is a header, then `bucket_count + 1` bucket offsets, then the
+   entries ordered by bucket, then the NUL-terminated keys. The entries of
+   bucket `i` are `entries[buckets[i]]` up to `entries[buckets[i + 1]]`. */
+struct hash_table_snapshot;
+
+/* Writes `count` (key, value) pairs to `path`, with buckets for `hash`,
+   which has to be one of `hash_functions`. The keys must be distinct. The
+   file is written next to `path` and renamed over it, so readers never see
+   half a snapshot. Returns false and sets `errno` if it couldn't. */
+bool hash_table_snapshot_write(const char *path,
+                               hash_function *hash,
+                               const char *const *keys,
+                               const uint32_t *values,
+                               size_t count);
+
+/* Returns `NULL` and sets `errno` if the file can't be mapped, or to
+   `EINVAL` if it isn't a snapshot. */
+struct hash_table_snapshot *hash_table_snapshot_open(const char *path);
+bool hash_table_snapshot_contains(struct hash_table_snapshot *snapshot,
+                                  const char *key);
+uint32_t hash_table_snapshot_get_value(struct hash_table_snapshot *snapshot,
+                                       const char *key);
+size_t hash_table_snapshot_size(struct hash_table_snapshot *snapshot);
+/* Returns how many bytes the file takes up. */
+size_t hash_table_snapshot_bytes(struct hash_table_snapshot *snapshot);
+void hash_table_snapshot_close(struct hash_table_snapshot *snapshot);
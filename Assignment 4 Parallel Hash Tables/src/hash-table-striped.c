@@ -0,0 +1,176 @@
+#include "hash-table-striped.h"
+
+#include "entry-arena.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+struct list_entry {
+	const char *key;
+	uint32_t value;
+	SLIST_ENTRY(list_entry) pointers;
+};
+
+SLIST_HEAD(list_head, list_entry);
+
+/* Padded to a cache line, so taking one lock doesn't steal the line of its
+   neighbours from other cores. */
+struct stripe {
+	pthread_rwlock_t lock;
+} __attribute__((aligned(64)));
+
+struct hash_table_striped {
+	struct list_head entries[HASH_TABLE_CAPACITY];
+	uint32_t stripe_count;
+	struct stripe *stripes;
+	struct entry_arena arena;
+};
+
+struct hash_table_striped *hash_table_striped_create()
+{
+	return hash_table_striped_create_with_stripes(HASH_TABLE_STRIPED_DEFAULT_STRIPES);
+}
+
+struct hash_table_striped *hash_table_striped_create_with_stripes(uint32_t stripes)
+{
+	assert(stripes > 0 && stripes <= HASH_TABLE_CAPACITY);
+	struct hash_table_striped *hash_table = calloc(1, sizeof(struct hash_table_striped));
+	assert(hash_table != NULL);
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		SLIST_INIT(&hash_table->entries[i]);
+	}
+
+	hash_table->stripe_count = stripes;
+	hash_table->stripes = aligned_alloc(64, stripes * sizeof(struct stripe));
+	assert(hash_table->stripes != NULL);
+	for (uint32_t i = 0; i < stripes; ++i) {
+		pthread_rwlock_init(&hash_table->stripes[i].lock, NULL);
+	}
+	entry_arena_init(&hash_table->arena, sizeof(struct list_entry));
+	return hash_table;
+}
+
+static uint32_t get_index(const char *key)
+{
+	assert(key != NULL);
+	return bernstein_hash(key) % HASH_TABLE_CAPACITY;
+}
+
+static pthread_rwlock_t *get_lock(struct hash_table_striped *hash_table,
+                                  uint32_t index)
+{
+	return &hash_table->stripes[index % hash_table->stripe_count].lock;
+}
+
+static struct list_entry *get_list_entry(struct list_head *list_head,
+                                         const char *key)
+{
+	struct list_entry *entry = NULL;
+
+	SLIST_FOREACH(entry, list_head, pointers) {
+		if (strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+bool hash_table_striped_contains(struct hash_table_striped *hash_table,
+                                 const char *key)
+{
+	uint32_t index = get_index(key);
+	pthread_rwlock_t *lock = get_lock(hash_table, index);
+	pthread_rwlock_rdlock(lock);
+	struct list_entry *list_entry = get_list_entry(&hash_table->entries[index], key);
+	pthread_rwlock_unlock(lock);
+	return list_entry != NULL;
+}
+
+void hash_table_striped_add_entry(struct hash_table_striped *hash_table,
+                                  const char *key,
+                                  uint32_t value)
+{
+	uint32_t index = get_index(key);
+	pthread_rwlock_t *lock = get_lock(hash_table, index);
+	struct list_head *list_head = &hash_table->entries[index];
+	pthread_rwlock_wrlock(lock);
+	struct list_entry *list_entry = get_list_entry(list_head, key);
+
+	/* Update the value if it already exists */
+	if (list_entry != NULL) {
+		list_entry->value = value;
+		pthread_rwlock_unlock(lock);
+		return;
+	}
+
+	list_entry = entry_arena_alloc(&hash_table->arena);
+	list_entry->key = key;
+	list_entry->value = value;
+	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+	pthread_rwlock_unlock(lock);
+}
+
+uint32_t hash_table_striped_get_value(struct hash_table_striped *hash_table,
+                                      const char *key)
+{
+	uint32_t index = get_index(key);
+	pthread_rwlock_t *lock = get_lock(hash_table, index);
+	pthread_rwlock_rdlock(lock);
+	struct list_entry *list_entry = get_list_entry(&hash_table->entries[index], key);
+	assert(list_entry != NULL);
+	uint32_t value = list_entry->value;
+	pthread_rwlock_unlock(lock);
+	return value;
+}
+
+/* Readers hold the stripe's lock too, so nobody can be looking at the entry
+   once we have unlinked it and it can be reused right away. */
+bool hash_table_striped_remove(struct hash_table_striped *hash_table,
+                               const char *key)
+{
+	uint32_t index = get_index(key);
+	pthread_rwlock_t *lock = get_lock(hash_table, index);
+	struct list_head *list_head = &hash_table->entries[index];
+	pthread_rwlock_wrlock(lock);
+	struct list_entry *list_entry = get_list_entry(list_head, key);
+	if (list_entry != NULL) {
+		SLIST_REMOVE(list_head, list_entry, list_entry, pointers);
+		entry_arena_free(&hash_table->arena, list_entry);
+	}
+	pthread_rwlock_unlock(lock);
+	return list_entry != NULL;
+}
+
+size_t hash_table_striped_lock_bytes(struct hash_table_striped *hash_table)
+{
+	return hash_table->stripe_count * sizeof(struct stripe);
+}
+
+void hash_table_striped_memory_usage(struct hash_table_striped *hash_table,
+                                     struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->bucket_bytes = sizeof(hash_table->entries);
+	usage->table_bytes = sizeof(struct hash_table_striped) - usage->bucket_bytes;
+	usage->lock_bytes = hash_table_striped_lock_bytes(hash_table);
+	usage->entry_bytes = entry_arena_bytes(&hash_table->arena);
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct list_entry *list_entry = NULL;
+		SLIST_FOREACH(list_entry, &hash_table->entries[i], pointers) {
+			++usage->keys;
+		}
+	}
+}
+
+void hash_table_striped_destroy(struct hash_table_striped *hash_table)
+{
+	for (uint32_t i = 0; i < hash_table->stripe_count; ++i) {
+		pthread_rwlock_destroy(&hash_table->stripes[i].lock);
+	}
+	free(hash_table->stripes);
+	entry_arena_destroy(&hash_table->arena);
+	free(hash_table);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The stripe count `hash_table_striped_create` uses. */
+#define HASH_TABLE_STRIPED_DEFAULT_STRIPES 64
+
+/* A hash table whose buckets share a smaller number of reader-writer locks,
+   bucket `i` being protected by stripe `i % stripes`. Buckets are just a
+   list head, and every lock has a cache line to itself, so fewer stripes
+   means less memory at the cost of more contention. Lookups only take the
+   lock for reading and never block each other. */
+struct hash_table_striped;
+struct hash_table_striped *hash_table_striped_create();
+/* `stripes` is between 1 and `HASH_TABLE_CAPACITY`. */
+struct hash_table_striped *hash_table_striped_create_with_stripes(uint32_t stripes);
+void hash_table_striped_add_entry(struct hash_table_striped *hash_table,
+                                  const char *key,
+                                  uint32_t value);
+bool hash_table_striped_contains(struct hash_table_striped *hash_table,
+                                 const char *key);
+uint32_t hash_table_striped_get_value(struct hash_table_striped *hash_table,
+                                      const char* key);
+bool hash_table_striped_remove(struct hash_table_striped *hash_table,
+                               const char *key);
+/* Returns how many bytes the locks take up. */
+size_t hash_table_striped_lock_bytes(struct hash_table_striped *hash_table);
+void hash_table_striped_memory_usage(struct hash_table_striped *hash_table,
+                                     struct hash_table_memory_usage *usage);
+void hash_table_striped_destroy(struct hash_table_striped *hash_table);
@@ -1,7 +1,11 @@
 #include "hash-table-base.h"
 
+#include "entry-arena.h"
+#include "epoch.h"
+
 #include <assert.h>
 #include <pthread.h>
+#include <stdalign.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/queue.h>
@@ -14,6 +18,13 @@ struct list_entry {
 
 SLIST_HEAD(list_head, list_entry);
 
+/* Lookups don't take the lock, so list pointers are published with release
+   stores and followed with acquire loads, like in v2. A value that's already
+   in the table is only ever read and written atomically. */
+#define rcu_dereference(pointer) __atomic_load_n(&(pointer), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(pointer, value) \
+	__atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+
 struct hash_table_entry {
 	struct list_head list_head;
 };
@@ -21,18 +32,26 @@ struct hash_table_entry {
 struct hash_table_v1 {
 	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
 	pthread_mutex_t mutex;
+	struct entry_arena arena;
+	struct epoch_domain epoch;
 };
 
+static void reclaim_entry(void *object, void *context);
+
 struct hash_table_v1 *hash_table_v1_create()
 {
-	struct hash_table_v1 *hash_table = calloc(1, sizeof(struct hash_table_v1));
+	struct hash_table_v1 *hash_table = aligned_alloc(alignof(struct hash_table_v1),
+	                                                 sizeof(struct hash_table_v1));
 	assert(hash_table != NULL);
+	memset(hash_table, 0, sizeof(struct hash_table_v1));
 	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
 		struct hash_table_entry *entry = &hash_table->entries[i];
 		SLIST_INIT(&entry->list_head);
 	}
 
 	pthread_mutex_init(&hash_table->mutex, NULL);
+	entry_arena_init(&hash_table->arena, sizeof(struct list_entry));
+	epoch_domain_init(&hash_table->epoch, reclaim_entry, hash_table);
 
 	return hash_table;
 }
@@ -51,22 +70,32 @@ static struct list_entry *get_list_entry(struct list_head *list_head,
 {
 	assert(key != NULL);
 
-	struct list_entry *entry = NULL;
-	
-	SLIST_FOREACH(entry, list_head, pointers) {
-	  if (strcmp(entry->key, key) == 0) {
-	    return entry;
-	  }
+	struct list_entry *entry = rcu_dereference(SLIST_FIRST(list_head));
+	while (entry != NULL) {
+		if (strcmp(entry->key, key) == 0) {
+			return entry;
+		}
+		entry = rcu_dereference(SLIST_NEXT(entry, pointers));
 	}
 	return NULL;
 }
 
+/* Called once no reader can still be looking at a removed entry. The key
+   belongs to the caller, so there's only the entry to give back. */
+static void reclaim_entry(void *object, void *context)
+{
+	struct hash_table_v1 *hash_table = context;
+	entry_arena_free(&hash_table->arena, object);
+}
+
 bool hash_table_v1_contains(struct hash_table_v1 *hash_table,
                             const char *key)
 {
 	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 	struct list_head *list_head = &hash_table_entry->list_head;
+	epoch_enter(&hash_table->epoch);
 	struct list_entry *list_entry = get_list_entry(list_head, key);
+	epoch_exit(&hash_table->epoch);
 	return list_entry != NULL;
 }
 
@@ -81,14 +110,16 @@ void hash_table_v1_add_entry(struct hash_table_v1 *hash_table,
 
 	/* Update the value if it already exists */
 	if (list_entry != NULL) {
-		list_entry->value = value;
+		__atomic_store_n(&list_entry->value, value, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&hash_table->mutex);
 		return;
 	}
 
-	list_entry = calloc(1, sizeof(struct list_entry));
+	list_entry = entry_arena_alloc(&hash_table->arena);
 	list_entry->key = key;
 	list_entry->value = value;
-	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
+	SLIST_NEXT(list_entry, pointers) = SLIST_FIRST(list_head);
+	rcu_assign_pointer(SLIST_FIRST(list_head), list_entry);
 
 	pthread_mutex_unlock(&hash_table->mutex);
 }
@@ -98,24 +129,83 @@ uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table,
 {
 	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 	struct list_head *list_head = &hash_table_entry->list_head;
+	epoch_enter(&hash_table->epoch);
 	struct list_entry *list_entry = get_list_entry(list_head, key);
 	assert(list_entry != NULL);
-	return list_entry->value;
+	uint32_t value = __atomic_load_n(&list_entry->value, __ATOMIC_RELAXED);
+	epoch_exit(&hash_table->epoch);
+	return value;
 }
 
-void hash_table_v1_destroy(struct hash_table_v1 *hash_table)
+/* Only the value changes, so like in v2 this needs no lock. */
+bool hash_table_v1_compare_exchange(struct hash_table_v1 *hash_table,
+                                    const char *key,
+                                    uint32_t expected,
+                                    uint32_t desired)
+{
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct list_head *list_head = &hash_table_entry->list_head;
+	epoch_enter(&hash_table->epoch);
+	struct list_entry *list_entry = get_list_entry(list_head, key);
+	bool exchanged = list_entry != NULL
+	                 && __atomic_compare_exchange_n(&list_entry->value,
+	                                                &expected,
+	                                                desired,
+	                                                false,
+	                                                __ATOMIC_ACQ_REL,
+	                                                __ATOMIC_RELAXED);
+	epoch_exit(&hash_table->epoch);
+	return exchanged;
+}
+
+/* Lookups don't take the lock, so one may be standing on the entry we
+   unlink. It keeps pointing at the rest of the list, and goes back to the
+   arena once every lookup that could have seen it is done. */
+bool hash_table_v1_remove(struct hash_table_v1 *hash_table,
+                          const char *key)
 {
+	pthread_mutex_lock(&hash_table->mutex);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	struct list_entry **link = &SLIST_FIRST(&hash_table_entry->list_head);
+	struct list_entry *list_entry = *link;
+	while (list_entry != NULL && strcmp(list_entry->key, key) != 0) {
+		link = &SLIST_NEXT(list_entry, pointers);
+		list_entry = *link;
+	}
+	if (list_entry == NULL) {
+		pthread_mutex_unlock(&hash_table->mutex);
+		return false;
+	}
+	rcu_assign_pointer(*link, SLIST_NEXT(list_entry, pointers));
+	pthread_mutex_unlock(&hash_table->mutex);
+
+	epoch_retire(&hash_table->epoch, list_entry);
+	return true;
+}
+
+void hash_table_v1_memory_usage(struct hash_table_v1 *hash_table,
+                                struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->bucket_bytes = sizeof(hash_table->entries);
+	usage->lock_bytes = sizeof(hash_table->mutex);
+	usage->table_bytes = sizeof(struct hash_table_v1) - usage->bucket_bytes
+	                     - usage->lock_bytes;
+	usage->entry_bytes = entry_arena_bytes(&hash_table->arena);
 	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
-		struct hash_table_entry *entry = &hash_table->entries[i];
-		struct list_head *list_head = &entry->list_head;
 		struct list_entry *list_entry = NULL;
-		while (!SLIST_EMPTY(list_head)) {
-			list_entry = SLIST_FIRST(list_head);
-			SLIST_REMOVE_HEAD(list_head, pointers);
-			free(list_entry);
+		SLIST_FOREACH(list_entry, &hash_table->entries[i].list_head, pointers) {
+			++usage->keys;
 		}
 	}
+}
 
+/* Every `list_entry` came from the arena, so we release them all at once
+   instead of walking the lists. */
+void hash_table_v1_destroy(struct hash_table_v1 *hash_table)
+{
+	epoch_domain_destroy(&hash_table->epoch);
+	entry_arena_destroy(&hash_table->arena);
 	pthread_mutex_destroy(&hash_table->mutex);
 	free(hash_table);
 }
@@ -13,4 +13,12 @@ bool hash_table_v1_contains(struct hash_table_v1 *hash_table,
                             const char *key);
 uint32_t hash_table_v1_get_value(struct hash_table_v1 *hash_table,
                                  const char* key);
+bool hash_table_v1_compare_exchange(struct hash_table_v1 *hash_table,
+                                    const char *key,
+                                    uint32_t expected,
+                                    uint32_t desired);
+bool hash_table_v1_remove(struct hash_table_v1 *hash_table,
+                          const char *key);
+void hash_table_v1_memory_usage(struct hash_table_v1 *hash_table,
+                                struct hash_table_memory_usage *usage);
 void hash_table_v1_destroy(struct hash_table_v1 *hash_table);
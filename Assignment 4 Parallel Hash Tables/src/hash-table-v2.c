@@ -1,119 +1,768 @@
-#include "hash-table-base.h"
-#include "src/hash-table-common.h"
+#include "hash-table-v2.h"
+
+#include "entry-arena.h"
+#include "epoch.h"
+#include "hash-table-snapshot.h"
 
 #include <assert.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <sys/queue.h>
 
+/* Keys shorter than this are copied into the entry itself, longer ones get
+   their own copy on the heap. Either way the table owns its keys, and the
+   caller's string can go away after `hash_table_v2_add_entry`. */
+#define INLINE_KEY_SIZE 16
+
+/* We keep the full hash of the key in the entry, so almost every entry that
+   doesn't match is skipped after a single integer compare. The last byte of
+   `inline_key` is always 0 for an inline key, we set it to 1 when the union
+   holds `heap_key` instead. */
 struct list_entry {
-	const char *key;
+	uint32_t hash;
 	uint32_t value;
 	SLIST_ENTRY(list_entry) pointers;
+	union {
+		char inline_key[INLINE_KEY_SIZE];
+		char *heap_key;
+	};
 };
 
 SLIST_HEAD(list_head, list_entry);
 
+/* Readers never take the bucket lock, so writers publish a new entry the
+   same way RCU does in the kernel. The entry is filled in completely and
+   only then made reachable with a release store. Readers follow every link
+   with an acquire load, so they see either the old list or the new entry
+   with all of its fields. Removing an entry works the same way, its
+   predecessor is pointed past it, but the entry itself keeps pointing at the
+   rest of the list so readers standing on it can carry on. Readers hold an
+   epoch while they look at entries, and removed entries are only reused
+   once every reader that could have seen them is done. */
+#define rcu_dereference(pointer) __atomic_load_n(&(pointer), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(pointer, value) \
+	__atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+
+/* Which lock is in use is decided for the whole table, see `lock`. */
 struct hash_table_entry {
 	struct list_head list_head;
-	pthread_mutex_t mutex;
+	union {
+		pthread_mutex_t mutex;
+		struct bucket_lock lock;
+	};
 };
 
 struct hash_table_v2 {
 	struct hash_table_entry entries[HASH_TABLE_CAPACITY];
+	hash_function *hash;
+	enum hash_table_v2_lock lock;
+	struct entry_arena arena;
+	/* How many entries have a `heap_key` that destroy needs to free. */
+	size_t heap_keys;
+	struct epoch_domain epoch;
 };
 
 struct hash_table_v2 *hash_table_v2_create()
 {
-	struct hash_table_v2 *hash_table = calloc(1, sizeof(struct hash_table_v2));
+	struct hash_table_v2_options options = { 0 };
+	return hash_table_v2_create_with_options(&options);
+}
+
+static void reclaim_entry(void *object, void *context);
+
+struct hash_table_v2 *hash_table_v2_create_with_options(const struct hash_table_v2_options *options)
+{
+	struct hash_table_v2 *hash_table = aligned_alloc(alignof(struct hash_table_v2),
+	                                                 sizeof(struct hash_table_v2));
 	assert(hash_table != NULL);
+	memset(hash_table, 0, sizeof(struct hash_table_v2));
+	hash_table->hash = options->hash != NULL ? options->hash : bernstein_hash;
+	hash_table->lock = options->lock;
+	entry_arena_init(&hash_table->arena, sizeof(struct list_entry));
+	epoch_domain_init(&hash_table->epoch, reclaim_entry, hash_table);
 	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
 		struct hash_table_entry *entry = &hash_table->entries[i];
-		pthread_mutex_init(&entry->mutex, NULL);
+		if (hash_table->lock == HASH_TABLE_V2_LOCK_ADAPTIVE) {
+			bucket_lock_init(&entry->lock, options->lock_timing);
+		}
+		else {
+			pthread_mutex_init(&entry->mutex, NULL);
+		}
 		SLIST_INIT(&entry->list_head);
 	}
 	return hash_table;
 }
 
 static struct hash_table_entry *get_hash_table_entry(struct hash_table_v2 *hash_table,
-                                                     const char *key)
+                                                     uint32_t hash)
 {
-	assert(key != NULL);
-	uint32_t index = bernstein_hash(key) % HASH_TABLE_CAPACITY;
+	uint32_t index = hash % HASH_TABLE_CAPACITY;
 	struct hash_table_entry *entry = &hash_table->entries[index];
 	return entry;
 }
 
+static void lock_entry(struct hash_table_v2 *hash_table,
+                       struct hash_table_entry *hash_table_entry)
+{
+	if (hash_table->lock == HASH_TABLE_V2_LOCK_ADAPTIVE) {
+		bucket_lock_lock(&hash_table_entry->lock);
+	}
+	else {
+		pthread_mutex_lock(&hash_table_entry->mutex);
+	}
+}
+
+static void unlock_entry(struct hash_table_v2 *hash_table,
+                         struct hash_table_entry *hash_table_entry)
+{
+	if (hash_table->lock == HASH_TABLE_V2_LOCK_ADAPTIVE) {
+		bucket_lock_unlock(&hash_table_entry->lock);
+	}
+	else {
+		pthread_mutex_unlock(&hash_table_entry->mutex);
+	}
+}
+
+static bool has_heap_key(struct list_entry *list_entry)
+{
+	return list_entry->inline_key[INLINE_KEY_SIZE - 1] != 0;
+}
+
+static const char *get_key(struct list_entry *list_entry)
+{
+	if (has_heap_key(list_entry)) {
+		return list_entry->heap_key;
+	}
+	return list_entry->inline_key;
+}
+
+static void set_key(struct list_entry *list_entry, const char *key)
+{
+	size_t length = strlen(key);
+	if (length < INLINE_KEY_SIZE) {
+		memcpy(list_entry->inline_key, key, length + 1);
+		memset(list_entry->inline_key + length, 0, INLINE_KEY_SIZE - length);
+	}
+	else {
+		list_entry->heap_key = strdup(key);
+		assert(list_entry->heap_key != NULL);
+		list_entry->inline_key[INLINE_KEY_SIZE - 1] = 1;
+	}
+}
+
 static struct list_entry *get_list_entry(struct list_head *list_head,
-                                         const char *key)
+                                         const char *key,
+                                         uint32_t hash)
 {
 	assert(key != NULL);
 
-	struct list_entry *entry = NULL;
-	
-	SLIST_FOREACH(entry, list_head, pointers) {
-	  if (strcmp(entry->key, key) == 0) {
-	    return entry;
-	  }
+	struct list_entry *entry = rcu_dereference(SLIST_FIRST(list_head));
+	while (entry != NULL) {
+		if (entry->hash == hash && strcmp(get_key(entry), key) == 0) {
+			return entry;
+		}
+		entry = rcu_dereference(SLIST_NEXT(entry, pointers));
 	}
 	return NULL;
 }
 
+/* Called once no reader can still be looking at a removed entry. */
+static void reclaim_entry(void *object, void *context)
+{
+	struct hash_table_v2 *hash_table = context;
+	struct list_entry *list_entry = object;
+	if (has_heap_key(list_entry)) {
+		free(list_entry->heap_key);
+		__atomic_fetch_sub(&hash_table->heap_keys, 1, __ATOMIC_RELAXED);
+	}
+	entry_arena_free(&hash_table->arena, list_entry);
+}
+
 bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
                             const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	uint32_t hash = hash_table->hash(key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(list_head, key);
+	epoch_enter(&hash_table->epoch);
+	struct list_entry *list_entry = get_list_entry(list_head, key, hash);
+	epoch_exit(&hash_table->epoch);
 	return list_entry != NULL;
 }
 
-void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
+/* Inserts or updates the key in `hash_table_entry`, the caller holds its
+   lock. */
+static void add_entry_locked(struct hash_table_v2 *hash_table,
+                             struct hash_table_entry *hash_table_entry,
                              const char *key,
+                             uint32_t hash,
                              uint32_t value)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
 	struct list_head *list_head = &hash_table_entry->list_head;
-
-	pthread_mutex_lock(&hash_table_entry->mutex);
-	struct list_entry *list_entry = get_list_entry(list_head, key);
+	struct list_entry *list_entry = get_list_entry(list_head, key, hash);
 
 	/* Update the value if it already exists */
 	if (list_entry != NULL) {
-		list_entry->value = value;
+		__atomic_store_n(&list_entry->value, value, __ATOMIC_RELAXED);
 		return;
 	}
 
-	list_entry = calloc(1, sizeof(struct list_entry));
-	list_entry->key = key;
+	list_entry = entry_arena_alloc(&hash_table->arena);
+	list_entry->hash = hash;
 	list_entry->value = value;
-	SLIST_INSERT_HEAD(list_head, list_entry, pointers);
-	pthread_mutex_unlock(&hash_table_entry->mutex);
+	set_key(list_entry, key);
+	if (has_heap_key(list_entry)) {
+		__atomic_fetch_add(&hash_table->heap_keys, 1, __ATOMIC_RELAXED);
+	}
+	SLIST_NEXT(list_entry, pointers) = SLIST_FIRST(list_head);
+	rcu_assign_pointer(SLIST_FIRST(list_head), list_entry);
+}
+
+void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
+                             const char *key,
+                             uint32_t value)
+{
+	assert(key != NULL);
+	uint32_t hash = hash_table->hash(key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
+
+	lock_entry(hash_table, hash_table_entry);
+	add_entry_locked(hash_table, hash_table_entry, key, hash, value);
+	unlock_entry(hash_table, hash_table_entry);
+}
+
+/* For a batch we hash every key up front and then order the keys by bucket
+   with a counting sort. It's stable, so if a key shows up more than once in
+   a batch the last value still wins. A batch smaller than the table is
+   sorted in two passes instead, first on the bucket modulo
+   `BATCH_LOW_RADIX`, then on the rest of it, so both histograms are tiny
+   instead of one counter per bucket. Either way every bucket's keys come
+   out next to each other. */
+#define BATCH_LOW_RADIX 64
+#define BATCH_HIGH_RADIX ((HASH_TABLE_CAPACITY + BATCH_LOW_RADIX - 1) / BATCH_LOW_RADIX)
+
+struct batch_order {
+	uint32_t *hashes;
+	size_t *order;
+};
+
+/* Orders the key indices in `from` by `bucket / divisor % radix` into `to`,
+   a `NULL` `from` stands for 0, 1, 2 and so on. */
+static void batch_order_pass(const uint32_t *hashes, const size_t *from,
+                             size_t *to, size_t count, size_t *offsets,
+                             size_t divisor, size_t radix)
+{
+	memset(offsets, 0, radix * sizeof(size_t));
+	for (size_t i = 0; i < count; ++i) {
+		++offsets[hashes[i] % HASH_TABLE_CAPACITY / divisor % radix];
+	}
+	size_t offset = 0;
+	for (size_t i = 0; i < radix; ++i) {
+		size_t digit_count = offsets[i];
+		offsets[i] = offset;
+		offset += digit_count;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		size_t index = from == NULL ? i : from[i];
+		size_t digit = hashes[index] % HASH_TABLE_CAPACITY / divisor % radix;
+		to[offsets[digit]++] = index;
+	}
+}
+
+static void batch_order_init(struct batch_order *batch_order,
+                             struct hash_table_v2 *hash_table,
+                             const char *const *keys,
+                             size_t count)
+{
+	bool small = count < HASH_TABLE_CAPACITY;
+	size_t radix = small ? (BATCH_LOW_RADIX > BATCH_HIGH_RADIX
+	                        ? BATCH_LOW_RADIX : BATCH_HIGH_RADIX)
+	                     : HASH_TABLE_CAPACITY;
+	size_t orders = small ? 2 : 1;
+
+	/* One allocation for everything, `order` first so it's aligned. */
+	char *memory = malloc(count * (orders * sizeof(size_t) + sizeof(uint32_t))
+	                      + radix * sizeof(size_t));
+	assert(memory != NULL);
+	batch_order->order = (size_t *) memory;
+	size_t *by_low = batch_order->order + count;
+	size_t *offsets = by_low + (orders - 1) * count;
+	batch_order->hashes = (uint32_t *) (offsets + radix);
+
+	for (size_t i = 0; i < count; ++i) {
+		assert(keys[i] != NULL);
+		batch_order->hashes[i] = hash_table->hash(keys[i]);
+	}
+	if (!small) {
+		batch_order_pass(batch_order->hashes, NULL, batch_order->order, count,
+		                 offsets, 1, HASH_TABLE_CAPACITY);
+		return;
+	}
+	batch_order_pass(batch_order->hashes, NULL, by_low, count, offsets,
+	                 1, BATCH_LOW_RADIX);
+	batch_order_pass(batch_order->hashes, by_low, batch_order->order, count,
+	                 offsets, BATCH_LOW_RADIX, BATCH_HIGH_RADIX);
+}
+
+static void batch_order_destroy(struct batch_order *batch_order)
+{
+	free(batch_order->order);
+}
+
+/* While we work on one bucket, we ask for the first entry of the next bucket
+   we'll visit so the cache miss overlaps with our work. */
+static void prefetch_bucket(struct hash_table_entry *hash_table_entry)
+{
+	__builtin_prefetch(hash_table_entry);
+	struct list_entry *first = rcu_dereference(SLIST_FIRST(&hash_table_entry->list_head));
+	if (first != NULL) {
+		__builtin_prefetch(first);
+	}
+}
+
+void hash_table_v2_add_batch(struct hash_table_v2 *hash_table,
+                             const char *const *keys,
+                             const uint32_t *values,
+                             size_t count)
+{
+	struct batch_order batch_order;
+	batch_order_init(&batch_order, hash_table, keys, count);
+
+	size_t i = 0;
+	while (i < count) {
+		uint32_t bucket = batch_order.hashes[batch_order.order[i]] % HASH_TABLE_CAPACITY;
+		size_t end = i + 1;
+		while (end < count
+		       && batch_order.hashes[batch_order.order[end]] % HASH_TABLE_CAPACITY == bucket) {
+			++end;
+		}
+		if (end < count) {
+			uint32_t hash = batch_order.hashes[batch_order.order[end]];
+			prefetch_bucket(get_hash_table_entry(hash_table, hash));
+		}
+
+		struct hash_table_entry *hash_table_entry = &hash_table->entries[bucket];
+		lock_entry(hash_table, hash_table_entry);
+		for (; i < end; ++i) {
+			size_t index = batch_order.order[i];
+			add_entry_locked(hash_table, hash_table_entry, keys[index],
+			                 batch_order.hashes[index], values[index]);
+		}
+		unlock_entry(hash_table, hash_table_entry);
+	}
+
+	batch_order_destroy(&batch_order);
+}
+
+/* A partition is a range of this many neighbouring buckets. */
+#define BUCKETS_PER_PARTITION 16
+#define PARTITIONS (HASH_TABLE_CAPACITY / BUCKETS_PER_PARTITION)
+
+struct bulk_build;
+
+/* The partitions a thread starts out with, `[next, end)`. Whoever takes
+   one, the owner or a thief, claims it with an atomic add on `next`. */
+struct bulk_thread {
+	struct bulk_build *bulk_build;
+	uint32_t thread;
+	pthread_t pthread;
+	alignas(64) _Atomic size_t next;
+	size_t end;
+	/* How many keys of the thread's slice of the input went to every
+	   partition, then where in `order` the first of them goes. */
+	size_t histogram[PARTITIONS];
+};
+
+struct bulk_build {
+	struct hash_table_v2 *hash_table;
+	const char *const *keys;
+	const uint32_t *values;
+	size_t count;
+	uint32_t thread_count;
+	struct bulk_thread *threads;
+	pthread_barrier_t barrier;
+	uint32_t *hashes;
+	/* The indices of the keys ordered by partition, partition `p` starts at
+	   `partition_offsets[p]`. */
+	size_t *order;
+	size_t partition_offsets[PARTITIONS + 1];
+};
+
+static size_t get_partition(uint32_t hash)
+{
+	return hash % HASH_TABLE_CAPACITY / BUCKETS_PER_PARTITION;
+}
+
+static void insert_partition(struct bulk_build *bulk_build, size_t partition)
+{
+	struct hash_table_v2 *hash_table = bulk_build->hash_table;
+	for (size_t i = bulk_build->partition_offsets[partition];
+	     i < bulk_build->partition_offsets[partition + 1]; ++i) {
+		size_t index = bulk_build->order[i];
+		uint32_t hash = bulk_build->hashes[index];
+		add_entry_locked(hash_table, get_hash_table_entry(hash_table, hash),
+		                 bulk_build->keys[index], hash, bulk_build->values[index]);
+	}
+}
+
+/* Every thread hashes a slice of the input and then writes the slice's
+   indices to their places in `order`. Partition `p` holds thread 0's keys
+   for `p` first, then thread 1's, and so on, so the keys stay in input
+   order within a partition. */
+static void *run_bulk_build(void *arg)
+{
+	struct bulk_thread *bulk_thread = arg;
+	struct bulk_build *bulk_build = bulk_thread->bulk_build;
+	uint32_t thread = bulk_thread->thread;
+	size_t start = bulk_build->count * thread / bulk_build->thread_count;
+	size_t end = bulk_build->count * (thread + 1) / bulk_build->thread_count;
+
+	for (size_t i = start; i < end; ++i) {
+		assert(bulk_build->keys[i] != NULL);
+		uint32_t hash = bulk_build->hash_table->hash(bulk_build->keys[i]);
+		bulk_build->hashes[i] = hash;
+		++bulk_thread->histogram[get_partition(hash)];
+	}
+	pthread_barrier_wait(&bulk_build->barrier);
+
+	if (thread == 0) {
+		size_t offset = 0;
+		for (size_t p = 0; p < PARTITIONS; ++p) {
+			bulk_build->partition_offsets[p] = offset;
+			for (uint32_t t = 0; t < bulk_build->thread_count; ++t) {
+				size_t keys = bulk_build->threads[t].histogram[p];
+				bulk_build->threads[t].histogram[p] = offset;
+				offset += keys;
+			}
+		}
+		bulk_build->partition_offsets[PARTITIONS] = offset;
+	}
+	pthread_barrier_wait(&bulk_build->barrier);
+
+	for (size_t i = start; i < end; ++i) {
+		size_t partition = get_partition(bulk_build->hashes[i]);
+		bulk_build->order[bulk_thread->histogram[partition]++] = i;
+	}
+	pthread_barrier_wait(&bulk_build->barrier);
+
+	/* Our own partitions first, then everyone else's */
+	for (uint32_t t = 0; t < bulk_build->thread_count; ++t) {
+		struct bulk_thread *victim = &bulk_build->threads[(thread + t) % bulk_build->thread_count];
+		while (true) {
+			size_t partition = atomic_fetch_add_explicit(&victim->next, 1,
+			                                             memory_order_relaxed);
+			if (partition >= victim->end) {
+				break;
+			}
+			insert_partition(bulk_build, partition);
+		}
+	}
+	return NULL;
+}
+
+void hash_table_v2_bulk_build(struct hash_table_v2 *hash_table,
+                              const char *const *keys,
+                              const uint32_t *values,
+                              size_t count,
+                              uint32_t threads)
+{
+	assert(threads > 0);
+	struct bulk_build *bulk_build = calloc(1, sizeof(struct bulk_build));
+	assert(bulk_build != NULL);
+	bulk_build->hash_table = hash_table;
+	bulk_build->keys = keys;
+	bulk_build->values = values;
+	bulk_build->count = count;
+	bulk_build->thread_count = threads;
+	bulk_build->threads = aligned_alloc(alignof(struct bulk_thread),
+	                                    threads * sizeof(struct bulk_thread));
+	bulk_build->hashes = malloc(count * sizeof(uint32_t));
+	bulk_build->order = malloc(count * sizeof(size_t));
+	assert(bulk_build->threads != NULL);
+	assert(count == 0 || (bulk_build->hashes != NULL && bulk_build->order != NULL));
+	pthread_barrier_init(&bulk_build->barrier, NULL, threads);
+
+	for (uint32_t t = 0; t < threads; ++t) {
+		struct bulk_thread *bulk_thread = &bulk_build->threads[t];
+		memset(bulk_thread, 0, sizeof(struct bulk_thread));
+		bulk_thread->bulk_build = bulk_build;
+		bulk_thread->thread = t;
+		atomic_init(&bulk_thread->next, (size_t) PARTITIONS * t / threads);
+		bulk_thread->end = (size_t) PARTITIONS * (t + 1) / threads;
+	}
+	for (uint32_t t = 1; t < threads; ++t) {
+		int err = pthread_create(&bulk_build->threads[t].pthread, NULL,
+		                         run_bulk_build, &bulk_build->threads[t]);
+		assert(err == 0);
+		(void) err;
+	}
+	run_bulk_build(&bulk_build->threads[0]);
+	for (uint32_t t = 1; t < threads; ++t) {
+		pthread_join(bulk_build->threads[t].pthread, NULL);
+	}
+
+	pthread_barrier_destroy(&bulk_build->barrier);
+	free(bulk_build->hashes);
+	free(bulk_build->order);
+	free(bulk_build->threads);
+	free(bulk_build);
+}
+
+void hash_table_v2_contains_batch(struct hash_table_v2 *hash_table,
+                                  const char *const *keys,
+                                  size_t count,
+                                  bool *results)
+{
+	struct batch_order batch_order;
+	batch_order_init(&batch_order, hash_table, keys, count);
+
+	epoch_enter(&hash_table->epoch);
+	for (size_t i = 0; i < count; ++i) {
+		size_t index = batch_order.order[i];
+		uint32_t hash = batch_order.hashes[index];
+		if (i + 1 < count) {
+			uint32_t next_hash = batch_order.hashes[batch_order.order[i + 1]];
+			prefetch_bucket(get_hash_table_entry(hash_table, next_hash));
+		}
+		struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
+		results[index] = get_list_entry(&hash_table_entry->list_head,
+		                                keys[index], hash) != NULL;
+	}
+	epoch_exit(&hash_table->epoch);
+
+	batch_order_destroy(&batch_order);
 }
 
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
                                  const char *key)
 {
-	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, key);
+	assert(key != NULL);
+	uint32_t hash = hash_table->hash(key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
 	struct list_head *list_head = &hash_table_entry->list_head;
-	struct list_entry *list_entry = get_list_entry(list_head, key);
+	epoch_enter(&hash_table->epoch);
+	struct list_entry *list_entry = get_list_entry(list_head, key, hash);
 	assert(list_entry != NULL);
-	return list_entry->value;
+	uint32_t value = __atomic_load_n(&list_entry->value, __ATOMIC_RELAXED);
+	epoch_exit(&hash_table->epoch);
+	return value;
+}
+
+bool hash_table_v2_compare_exchange(struct hash_table_v2 *hash_table,
+                                    const char *key,
+                                    uint32_t expected,
+                                    uint32_t desired)
+{
+	assert(key != NULL);
+	uint32_t hash = hash_table->hash(key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
+	struct list_head *list_head = &hash_table_entry->list_head;
+	epoch_enter(&hash_table->epoch);
+	struct list_entry *list_entry = get_list_entry(list_head, key, hash);
+	bool exchanged = list_entry != NULL
+	                 && __atomic_compare_exchange_n(&list_entry->value,
+	                                                &expected,
+	                                                desired,
+	                                                false,
+	                                                __ATOMIC_ACQ_REL,
+	                                                __ATOMIC_RELAXED);
+	epoch_exit(&hash_table->epoch);
+	return exchanged;
+}
+
+/* Once a key is in the table only its value changes, so the common case is
+   an atomic add without the bucket lock. Only a key we didn't find needs
+   the lock, and we look again under it in case another thread added the
+   key in the meantime. */
+uint32_t hash_table_v2_fetch_add(struct hash_table_v2 *hash_table,
+                                 const char *key,
+                                 uint32_t delta)
+{
+	assert(key != NULL);
+	uint32_t hash = hash_table->hash(key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
+	struct list_head *list_head = &hash_table_entry->list_head;
+	epoch_enter(&hash_table->epoch);
+	struct list_entry *list_entry = get_list_entry(list_head, key, hash);
+	if (list_entry != NULL) {
+		uint32_t value = __atomic_fetch_add(&list_entry->value, delta,
+		                                    __ATOMIC_RELAXED);
+		epoch_exit(&hash_table->epoch);
+		return value;
+	}
+	epoch_exit(&hash_table->epoch);
+
+	lock_entry(hash_table, hash_table_entry);
+	list_entry = get_list_entry(list_head, key, hash);
+	uint32_t value = 0;
+	if (list_entry != NULL) {
+		value = __atomic_fetch_add(&list_entry->value, delta, __ATOMIC_RELAXED);
+	}
+	else {
+		add_entry_locked(hash_table, hash_table_entry, key, hash, delta);
+	}
+	unlock_entry(hash_table, hash_table_entry);
+	return value;
+}
+
+/* Unlinks the entry under the bucket lock, then retires it. It stays
+   readable until the epoch moves on and `reclaim_entry` gets it. */
+bool hash_table_v2_remove(struct hash_table_v2 *hash_table,
+                          const char *key)
+{
+	assert(key != NULL);
+	uint32_t hash = hash_table->hash(key);
+	struct hash_table_entry *hash_table_entry = get_hash_table_entry(hash_table, hash);
+	struct list_head *list_head = &hash_table_entry->list_head;
+
+	lock_entry(hash_table, hash_table_entry);
+	struct list_entry **link = &SLIST_FIRST(list_head);
+	struct list_entry *list_entry = *link;
+	while (list_entry != NULL) {
+		if (list_entry->hash == hash && strcmp(get_key(list_entry), key) == 0) {
+			break;
+		}
+		link = &SLIST_NEXT(list_entry, pointers);
+		list_entry = *link;
+	}
+	if (list_entry == NULL) {
+		unlock_entry(hash_table, hash_table_entry);
+		return false;
+	}
+	rcu_assign_pointer(*link, SLIST_NEXT(list_entry, pointers));
+	unlock_entry(hash_table, hash_table_entry);
+
+	epoch_retire(&hash_table->epoch, list_entry);
+	return true;
+}
+
+/* The whole walk is one epoch, so no entry we can reach gets reused. */
+void hash_table_v2_iterator_begin(struct hash_table_v2_iterator *iterator,
+                                  struct hash_table_v2 *hash_table)
+{
+	iterator->hash_table = hash_table;
+	iterator->bucket = 0;
+	epoch_enter(&hash_table->epoch);
+	iterator->next = rcu_dereference(SLIST_FIRST(&hash_table->entries[0].list_head));
+}
+
+bool hash_table_v2_iterator_next(struct hash_table_v2_iterator *iterator,
+                                 const char **key,
+                                 uint32_t *value)
+{
+	struct hash_table_v2 *hash_table = iterator->hash_table;
+	while (iterator->next == NULL) {
+		if (++iterator->bucket == HASH_TABLE_CAPACITY) {
+			return false;
+		}
+		struct list_head *list_head = &hash_table->entries[iterator->bucket].list_head;
+		iterator->next = rcu_dereference(SLIST_FIRST(list_head));
+	}
+	struct list_entry *list_entry = iterator->next;
+	iterator->next = rcu_dereference(SLIST_NEXT(list_entry, pointers));
+	*key = get_key(list_entry);
+	*value = __atomic_load_n(&list_entry->value, __ATOMIC_RELAXED);
+	return true;
+}
+
+void hash_table_v2_iterator_end(struct hash_table_v2_iterator *iterator)
+{
+	epoch_exit(&iterator->hash_table->epoch);
 }
 
+bool hash_table_v2_snapshot(struct hash_table_v2 *hash_table, const char *path)
+{
+	size_t capacity = 1024;
+	size_t count = 0;
+	const char **keys = malloc(capacity * sizeof(char *));
+	uint32_t *values = malloc(capacity * sizeof(uint32_t));
+	assert(keys != NULL && values != NULL);
+
+	struct hash_table_v2_iterator iterator;
+	hash_table_v2_iterator_begin(&iterator, hash_table);
+	const char *key;
+	uint32_t value;
+	while (hash_table_v2_iterator_next(&iterator, &key, &value)) {
+		if (count == capacity) {
+			capacity *= 2;
+			keys = realloc(keys, capacity * sizeof(char *));
+			values = realloc(values, capacity * sizeof(uint32_t));
+			assert(keys != NULL && values != NULL);
+		}
+		keys[count] = key;
+		values[count] = value;
+		++count;
+	}
+	bool written = hash_table_snapshot_write(path, hash_table->hash, keys,
+	                                         values, count);
+	hash_table_v2_iterator_end(&iterator);
+
+	free(keys);
+	free(values);
+	return written;
+}
+
+bool hash_table_v2_lock_stats(struct hash_table_v2 *hash_table,
+                              size_t bucket,
+                              struct bucket_lock_stats *stats)
+{
+	assert(bucket < HASH_TABLE_CAPACITY);
+	if (hash_table->lock != HASH_TABLE_V2_LOCK_ADAPTIVE) {
+		return false;
+	}
+	*stats = hash_table->entries[bucket].lock.stats;
+	return true;
+}
+
+size_t hash_table_v2_entry_size(void)
+{
+	return sizeof(struct list_entry);
+}
+
+/* The locks are part of the buckets, we count them separately to see what
+   they cost. */
+void hash_table_v2_memory_usage(struct hash_table_v2 *hash_table,
+                                struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->bucket_bytes = HASH_TABLE_CAPACITY * sizeof(struct list_head);
+	usage->lock_bytes = sizeof(hash_table->entries) - usage->bucket_bytes;
+	usage->table_bytes = sizeof(struct hash_table_v2) - sizeof(hash_table->entries);
+	usage->entry_bytes = entry_arena_bytes(&hash_table->arena);
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct list_entry *list_entry = NULL;
+		SLIST_FOREACH(list_entry, &hash_table->entries[i].list_head, pointers) {
+			++usage->keys;
+			if (has_heap_key(list_entry)) {
+				usage->key_bytes += hash_table_heap_bytes(list_entry->heap_key);
+			}
+		}
+	}
+}
+
+/* Every `list_entry` came from the arena, so we release them all at once.
+   We only need to walk the lists if some keys were too long to be inline. */
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table)
 {
+	epoch_domain_destroy(&hash_table->epoch);
 	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
 		struct hash_table_entry *entry = &hash_table->entries[i];
-		struct list_head *list_head = &entry->list_head;
-		struct list_entry *list_entry = NULL;
-		while (!SLIST_EMPTY(list_head)) {
-			list_entry = SLIST_FIRST(list_head);
-			SLIST_REMOVE_HEAD(list_head, pointers);
+		if (hash_table->heap_keys > 0) {
+			struct list_entry *list_entry = NULL;
+			SLIST_FOREACH(list_entry, &entry->list_head, pointers) {
+				if (has_heap_key(list_entry)) {
+					free(list_entry->heap_key);
+				}
+			}
+		}
+		if (hash_table->lock == HASH_TABLE_V2_LOCK_MUTEX) {
 			pthread_mutex_destroy(&entry->mutex);
-			free(list_entry);
 		}
 	}
+	entry_arena_destroy(&hash_table->arena);
 	free(hash_table);
 }
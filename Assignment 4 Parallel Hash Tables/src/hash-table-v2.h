@@ -1,16 +1,113 @@
 #pragma once
 
+#include "bucket-lock.h"
 #include "hash-table-common.h"
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct hash_table_v2;
+
+enum hash_table_v2_lock {
+	/* A `pthread_mutex_t` per bucket. */
+	HASH_TABLE_V2_LOCK_MUTEX,
+	/* A `bucket_lock` per bucket, which spins before it sleeps and counts
+	   how contended it is. */
+	HASH_TABLE_V2_LOCK_ADAPTIVE,
+};
+
+/* Settings for `hash_table_v2_create_with_options`, zero initialize it and
+   set what you need. */
+struct hash_table_v2_options {
+	/* Defaults to `bernstein_hash` if `NULL`. */
+	hash_function *hash;
+	enum hash_table_v2_lock lock;
+	/* With the adaptive lock, also measure how long every lock is held. */
+	bool lock_timing;
+};
+
 struct hash_table_v2 *hash_table_v2_create();
+struct hash_table_v2 *hash_table_v2_create_with_options(const struct hash_table_v2_options *options);
+/* The table keeps its own copy of the key. */
 void hash_table_v2_add_entry(struct hash_table_v2 *hash_table,
                              const char *key,
                              uint32_t value);
 bool hash_table_v2_contains(struct hash_table_v2 *hash_table,
                             const char *key);
+/* Adds `count` (key, value) pairs, `keys[i]` gets `values[i]`. The keys are
+   grouped by bucket first, so every bucket's lock is taken once per batch. */
+void hash_table_v2_add_batch(struct hash_table_v2 *hash_table,
+                             const char *const *keys,
+                             const uint32_t *values,
+                             size_t count);
+/* Adds `count` (key, value) pairs using `threads` threads of its own, for
+   filling a table nobody else is using yet. The keys are first partitioned
+   by bucket, so every thread inserts into buckets no other thread touches
+   and takes no locks. Threads that run out of partitions take some from the
+   others. As with a batch, the last value for a key wins. */
+void hash_table_v2_bulk_build(struct hash_table_v2 *hash_table,
+                              const char *const *keys,
+                              const uint32_t *values,
+                              size_t count,
+                              uint32_t threads);
+/* Sets `results[i]` to whether `keys[i]` is in the hash table. */
+void hash_table_v2_contains_batch(struct hash_table_v2 *hash_table,
+                                  const char *const *keys,
+                                  size_t count,
+                                  bool *results);
 uint32_t hash_table_v2_get_value(struct hash_table_v2 *hash_table,
                                  const char* key);
+/* Sets the key's value to `desired` if it's currently `expected`. Returns
+   false if the value was different or the key isn't in the table. */
+bool hash_table_v2_compare_exchange(struct hash_table_v2 *hash_table,
+                                    const char *key,
+                                    uint32_t expected,
+                                    uint32_t desired);
+/* Adds `delta` to the key's value and returns the value it had before, as
+   one atomic step. A key that isn't in the table yet is added with the
+   value `delta`, and 0 is returned. Counting with a lookup followed by
+   `hash_table_v2_add_entry` would lose updates between the two. */
+uint32_t hash_table_v2_fetch_add(struct hash_table_v2 *hash_table,
+                                 const char *key,
+                                 uint32_t delta);
+/* Removes the key, returns whether it was in the table. */
+bool hash_table_v2_remove(struct hash_table_v2 *hash_table,
+                          const char *key);
+
+/* Walks the entries while other threads keep using the table. Every key
+   that is in the table for the whole walk is seen exactly once, keys added
+   or removed meanwhile may or may not be. Keys and values handed out stay
+   valid until `hash_table_v2_iterator_end`, which has to be called on the
+   same thread. Removed entries aren't reused while a walk is going on, so
+   don't keep one open for long. */
+struct hash_table_v2_iterator {
+	struct hash_table_v2 *hash_table;
+	size_t bucket;
+	/* The entry `hash_table_v2_iterator_next` returns next. */
+	void *next;
+};
+
+void hash_table_v2_iterator_begin(struct hash_table_v2_iterator *iterator,
+                                  struct hash_table_v2 *hash_table);
+/* Returns false once there are no entries left. */
+bool hash_table_v2_iterator_next(struct hash_table_v2_iterator *iterator,
+                                 const char **key,
+                                 uint32_t *value);
+void hash_table_v2_iterator_end(struct hash_table_v2_iterator *iterator);
+
+/* Writes the table's entries to a file `hash_table_snapshot_open` can map,
+   while other threads keep using it, with the same guarantees as an
+   iterator. The table has to use one of `hash_functions`. Returns false and
+   sets `errno` if it couldn't. */
+bool hash_table_v2_snapshot(struct hash_table_v2 *hash_table, const char *path);
+/* Copies the lock statistics of bucket `bucket` (below
+   `HASH_TABLE_CAPACITY`) to `stats`. Returns false if the table doesn't use
+   the adaptive lock. No other thread may be using the table. */
+bool hash_table_v2_lock_stats(struct hash_table_v2 *hash_table,
+                              size_t bucket,
+                              struct bucket_lock_stats *stats);
+void hash_table_v2_memory_usage(struct hash_table_v2 *hash_table,
+                                struct hash_table_memory_usage *usage);
+/* Returns the size of the object every inserted key takes. */
+size_t hash_table_v2_entry_size(void);
 void hash_table_v2_destroy(struct hash_table_v2 *hash_table);
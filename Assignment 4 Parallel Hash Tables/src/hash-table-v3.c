@@ -0,0 +1,197 @@
+#include "hash-table-v3.h"
+
+#include <assert.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+#define SLOTS_PER_BUCKET 4
+
+/* Every bucket is exactly one cache line. A lookup compares the 8-bit tags
+   (taken from the top of the hash, the bottom selects the bucket) and only
+   follows a key pointer when the tag matches. Slots are filled in order, so
+   `count` is also the next free slot. Once a bucket is full we probe into an
+   overflow bucket linked from `next`.
+
+   Only the lock of the first bucket in a chain is used, it protects writers
+   on the whole chain. Readers take no lock: a writer fills in the slot before
+   publishing it with a release store to `count` (or `next` for a new overflow
+   bucket), and readers load those with acquire. */
+struct bucket {
+	uint8_t tags[SLOTS_PER_BUCKET];
+	_Atomic uint8_t count;
+	atomic_flag lock;
+	const char *keys[SLOTS_PER_BUCKET];
+	_Atomic uint32_t values[SLOTS_PER_BUCKET];
+	struct bucket *_Atomic next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+_Static_assert(sizeof(struct bucket) == CACHE_LINE_SIZE,
+               "a bucket should fill exactly one cache line");
+
+struct hash_table_v3 {
+	struct bucket buckets[HASH_TABLE_CAPACITY];
+};
+
+static struct bucket *bucket_create(void)
+{
+	struct bucket *bucket = aligned_alloc(alignof(struct bucket),
+	                                      sizeof(struct bucket));
+	assert(bucket != NULL);
+	memset(bucket, 0, sizeof(struct bucket));
+	atomic_flag_clear(&bucket->lock);
+	return bucket;
+}
+
+struct hash_table_v3 *hash_table_v3_create()
+{
+	struct hash_table_v3 *hash_table = aligned_alloc(alignof(struct hash_table_v3),
+	                                                 sizeof(struct hash_table_v3));
+	assert(hash_table != NULL);
+	memset(hash_table, 0, sizeof(struct hash_table_v3));
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		atomic_flag_clear(&hash_table->buckets[i].lock);
+	}
+	return hash_table;
+}
+
+static void bucket_lock(struct bucket *bucket)
+{
+	while (atomic_flag_test_and_set_explicit(&bucket->lock,
+	                                         memory_order_acquire)) {
+		sched_yield();
+	}
+}
+
+static void bucket_unlock(struct bucket *bucket)
+{
+	atomic_flag_clear_explicit(&bucket->lock, memory_order_release);
+}
+
+static uint8_t get_tag(uint32_t hash)
+{
+	return hash >> 24;
+}
+
+/* Probes the chain starting at `bucket` for the key. On a match it returns
+   the bucket containing the key and sets `slot`, otherwise it returns `NULL`
+   and sets `last` (if given) to the final bucket of the chain. */
+static struct bucket *find_slot(struct bucket *bucket,
+                                const char *key,
+                                uint8_t tag,
+                                size_t *slot,
+                                struct bucket **last)
+{
+	assert(key != NULL);
+	while (true) {
+		uint8_t count = atomic_load_explicit(&bucket->count,
+		                                     memory_order_acquire);
+		for (size_t i = 0; i < count; ++i) {
+			if (bucket->tags[i] == tag && strcmp(bucket->keys[i], key) == 0) {
+				*slot = i;
+				return bucket;
+			}
+		}
+		struct bucket *next = atomic_load_explicit(&bucket->next,
+		                                           memory_order_acquire);
+		if (next == NULL) {
+			break;
+		}
+		bucket = next;
+	}
+	if (last != NULL) {
+		*last = bucket;
+	}
+	return NULL;
+}
+
+bool hash_table_v3_contains(struct hash_table_v3 *hash_table,
+                            const char *key)
+{
+	uint32_t hash = bernstein_hash(key);
+	struct bucket *head = &hash_table->buckets[hash % HASH_TABLE_CAPACITY];
+	size_t slot;
+	return find_slot(head, key, get_tag(hash), &slot, NULL) != NULL;
+}
+
+void hash_table_v3_add_entry(struct hash_table_v3 *hash_table,
+                             const char *key,
+                             uint32_t value)
+{
+	uint32_t hash = bernstein_hash(key);
+	uint8_t tag = get_tag(hash);
+	struct bucket *head = &hash_table->buckets[hash % HASH_TABLE_CAPACITY];
+
+	bucket_lock(head);
+	size_t slot;
+	struct bucket *last;
+	struct bucket *bucket = find_slot(head, key, tag, &slot, &last);
+
+	/* Update the value if it already exists */
+	if (bucket != NULL) {
+		atomic_store_explicit(&bucket->values[slot], value,
+		                      memory_order_relaxed);
+		bucket_unlock(head);
+		return;
+	}
+
+	/* Only the lock holder writes `count`, so a relaxed load is enough */
+	uint8_t count = atomic_load_explicit(&last->count, memory_order_relaxed);
+	if (count == SLOTS_PER_BUCKET) {
+		struct bucket *overflow = bucket_create();
+		atomic_store_explicit(&last->next, overflow, memory_order_release);
+		last = overflow;
+		count = 0;
+	}
+	last->tags[count] = tag;
+	last->keys[count] = key;
+	atomic_store_explicit(&last->values[count], value, memory_order_relaxed);
+	atomic_store_explicit(&last->count, count + 1, memory_order_release);
+	bucket_unlock(head);
+}
+
+uint32_t hash_table_v3_get_value(struct hash_table_v3 *hash_table,
+                                 const char *key)
+{
+	uint32_t hash = bernstein_hash(key);
+	struct bucket *head = &hash_table->buckets[hash % HASH_TABLE_CAPACITY];
+	size_t slot;
+	struct bucket *bucket = find_slot(head, key, get_tag(hash), &slot, NULL);
+	assert(bucket != NULL);
+	return atomic_load_explicit(&bucket->values[slot], memory_order_relaxed);
+}
+
+/* A bucket's lock is one of its bytes, so it's counted with the bucket. */
+void hash_table_v3_memory_usage(struct hash_table_v3 *hash_table,
+                                struct hash_table_memory_usage *usage)
+{
+	memset(usage, 0, sizeof(struct hash_table_memory_usage));
+	usage->bucket_bytes = sizeof(hash_table->buckets);
+	usage->table_bytes = sizeof(struct hash_table_v3) - usage->bucket_bytes;
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct bucket *bucket = &hash_table->buckets[i];
+		while (bucket != NULL) {
+			usage->keys += atomic_load(&bucket->count);
+			if (bucket != &hash_table->buckets[i]) {
+				usage->entry_bytes += sizeof(struct bucket);
+			}
+			bucket = atomic_load(&bucket->next);
+		}
+	}
+}
+
+void hash_table_v3_destroy(struct hash_table_v3 *hash_table)
+{
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct bucket *overflow = hash_table->buckets[i].next;
+		while (overflow != NULL) {
+			struct bucket *next = overflow->next;
+			free(overflow);
+			overflow = next;
+		}
+	}
+	free(hash_table);
+}
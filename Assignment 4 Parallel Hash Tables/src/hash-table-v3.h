@@ -0,0 +1,22 @@
+#pragma once
+
+#include "hash-table-common.h"
+
+#include <stdbool.h>
+
+/* An open-addressing variant of the hash table. Instead of one heap node per
+   (key, value) pair, every bucket is a single cache line holding a few slots
+   and a short fingerprint for each of them. Full buckets overflow into
+   another cache-line bucket. */
+struct hash_table_v3;
+struct hash_table_v3 *hash_table_v3_create();
+void hash_table_v3_add_entry(struct hash_table_v3 *hash_table,
+                             const char *key,
+                             uint32_t value);
+bool hash_table_v3_contains(struct hash_table_v3 *hash_table,
+                            const char *key);
+uint32_t hash_table_v3_get_value(struct hash_table_v3 *hash_table,
+                                 const char* key);
+void hash_table_v3_memory_usage(struct hash_table_v3 *hash_table,
+                                struct hash_table_memory_usage *usage);
+void hash_table_v3_destroy(struct hash_table_v3 *hash_table);
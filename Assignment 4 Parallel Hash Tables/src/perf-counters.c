@@ -0,0 +1,111 @@
+#include "perf-counters.h"
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} events[PERF_COUNTER_COUNT] = {
+	[PERF_COUNTER_CYCLES] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_COUNTER_INSTRUCTIONS] = {
+		"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_COUNTER_LLC_MISSES] = {
+		"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_COUNTER_BRANCH_MISSES] = {
+		"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[PERF_COUNTER_CONTEXT_SWITCHES] = {
+		"context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* What a counter opened with our `read_format` reads as. */
+struct read_value {
+	uint64_t value;
+	uint64_t time_enabled;
+	uint64_t time_running;
+};
+
+const char *perf_counter_name(enum perf_counter counter)
+{
+	return events[counter].name;
+}
+
+/* glibc has no wrapper for this system call. */
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+                           int group_fd, unsigned long flags)
+{
+	return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/* Every counter is opened on its own rather than as a group, so one the
+   kernel refuses doesn't take the others down with it. We first ask to
+   count in the kernel too, context switches happen there, and settle for
+   user space only if `perf_event_paranoid` says no. */
+static int open_counter(enum perf_counter counter)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[counter].type;
+	attr.config = events[counter].config;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+	                   | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	int fd = perf_event_open(&attr, 0, -1, -1, 0);
+	if (fd < 0) {
+		attr.exclude_kernel = 1;
+		fd = perf_event_open(&attr, 0, -1, -1, 0);
+	}
+	return fd;
+}
+
+void perf_counters_start(struct perf_counters *counters)
+{
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		counters->fds[i] = open_counter(i);
+		counters->available[i] = counters->fds[i] >= 0;
+		counters->values[i] = 0;
+	}
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		if (counters->available[i]) {
+			ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+void perf_counters_stop(struct perf_counters *counters)
+{
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		if (counters->available[i]) {
+			ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (size_t i = 0; i < PERF_COUNTER_COUNT; ++i) {
+		if (!counters->available[i]) {
+			continue;
+		}
+		struct read_value read_value;
+		if (read(counters->fds[i], &read_value, sizeof(read_value))
+		    != sizeof(read_value)) {
+			counters->available[i] = false;
+		}
+		else if (read_value.time_running > 0
+		         && read_value.time_running < read_value.time_enabled) {
+			counters->values[i] = (double) read_value.value
+			                      * read_value.time_enabled
+			                      / read_value.time_running;
+		}
+		else {
+			counters->values[i] = read_value.value;
+		}
+		close(counters->fds[i]);
+	}
+}
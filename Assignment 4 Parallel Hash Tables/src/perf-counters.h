@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum perf_counter {
+	PERF_COUNTER_CYCLES,
+	PERF_COUNTER_INSTRUCTIONS,
+	PERF_COUNTER_LLC_MISSES,
+	PERF_COUNTER_BRANCH_MISSES,
+	PERF_COUNTER_CONTEXT_SWITCHES,
+	PERF_COUNTER_COUNT,
+};
+
+/* Hardware and software event counters for the calling thread, read
+   straight from the kernel with `perf_event_open`. A counter the kernel
+   won't give us (no PMU in a VM, `perf_event_paranoid` too high, ...) is
+   simply left unavailable, so callers always get whatever subset works. */
+struct perf_counters {
+	int fds[PERF_COUNTER_COUNT];
+	bool available[PERF_COUNTER_COUNT];
+	uint64_t values[PERF_COUNTER_COUNT];
+};
+
+const char *perf_counter_name(enum perf_counter counter);
+
+/* Opens the counters for the calling thread and starts counting. */
+void perf_counters_start(struct perf_counters *counters);
+/* Stops counting, fills in `values` and closes the counters. If the kernel
+   had to share the hardware between more counters than it has, the values
+   are scaled up to the whole time the counter was enabled. */
+void perf_counters_stop(struct perf_counters *counters);
@@ -0,0 +1,430 @@
+#include "hash-table-base.h"
+#include "hash-table-v2.h"
+#include "bench.h"
+#include "workload.h"
+
+#include <argp.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Counts how many times every key appears in a set of files with one key per
+   line, a parallel `sort | uniq -c`. The input is split into one chunk per
+   thread. Every thread counts its chunk into a table of its own, and only
+   then adds its counts to the shared table, so a key that shows up a
+   million times costs one update of the shared table per thread instead of
+   a million. We also time every thread counting straight into the shared
+   table, to see what that buys. */
+
+struct arguments {
+	uint32_t threads;
+	bool scaling;
+	uint32_t top;
+	uint32_t write;
+	char **files;
+	size_t file_count;
+};
+
+/* Options without a short name use keys outside of the character range. */
+enum {
+	OPTION_SCALING = 0x100,
+	OPTION_TOP,
+	OPTION_WRITE,
+};
+
+static struct argp_option options[] = {
+	{ "threads", 't', "NUM", 0, "Number of threads.", 0},
+	{ "scaling", OPTION_SCALING, 0, 0,
+	  "Time 1, 2, 4, ... threads up to the thread count.", 0},
+	{ "top", OPTION_TOP, "NUM", 0,
+	  "Print the NUM most common keys and their counts.", 0},
+	{ "write", OPTION_WRITE, "NUM", 0,
+	  "First overwrite every FILE with NUM keys picked with a Zipfian "
+	  "skew.", 0},
+	{ 0 }
+};
+
+static uint32_t parse_number(const char *string, struct argp_state *state)
+{
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(string, &end, 10);
+	if (errno != 0 || *string == 0 || *end != 0 || value > UINT32_MAX) {
+		argp_error(state, "'%s' isn't a number", string);
+	}
+	return value;
+}
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+	struct arguments *arguments = state->input;
+	switch (key) {
+	case 't':
+		arguments->threads = parse_number(arg, state);
+		if (arguments->threads == 0) {
+			argp_error(state, "need at least one thread");
+		}
+		break;
+	case OPTION_SCALING:
+		arguments->scaling = true;
+		break;
+	case OPTION_TOP:
+		arguments->top = parse_number(arg, state);
+		break;
+	case OPTION_WRITE:
+		arguments->write = parse_number(arg, state);
+		break;
+	case ARGP_KEY_ARGS:
+		arguments->files = &state->argv[state->next];
+		arguments->file_count = state->argc - state->next;
+		break;
+	case ARGP_KEY_NO_ARGS:
+		argp_error(state, "no input files");
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct arguments arguments;
+
+/* Every file one after the other, each key ends with a NUL instead of the
+   newline once it's been parsed. */
+static char *input;
+static size_t input_bytes;
+
+/* Thread `i` gets the keys that start in `[chunks[i], chunks[i + 1])`. */
+static size_t *chunks;
+static uint64_t *chunk_records;
+
+static struct hash_table_v2 *shared;
+static struct hash_table_base **locals;
+
+static unsigned long usec_since(uint64_t start)
+{
+	return (bench_nsec_now() - start) / 1000;
+}
+
+static unsigned long run_threads(pthread_t *threads, uint32_t count,
+                                 void *(*run)(void *))
+{
+	uint64_t start = bench_nsec_now();
+	for (uintptr_t i = 0; i < count; ++i) {
+		int err = pthread_create(&threads[i], NULL, run, (void*) i);
+		if (err != 0) {
+			printf("pthread_create returned %d\n", err);
+			exit(err);
+		}
+	}
+	for (uintptr_t i = 0; i < count; ++i) {
+		int err = pthread_join(threads[i], NULL);
+		if (err != 0) {
+			printf("pthread_join returned %d\n", err);
+			exit(err);
+		}
+	}
+	return usec_since(start);
+}
+
+static void write_keys(void)
+{
+	struct workload workload;
+	workload_init(&workload, WORKLOAD_ZIPF, 7, 0, arguments.file_count,
+	              arguments.write);
+	size_t stride = workload_stride(&workload);
+	char *keys = malloc(arguments.write * stride + 1);
+	assert(keys != NULL);
+	for (size_t i = 0; i < arguments.file_count; ++i) {
+		workload_fill(&workload, i, keys);
+		FILE *file = fopen(arguments.files[i], "w");
+		if (file == NULL) {
+			perror(arguments.files[i]);
+			exit(1);
+		}
+		for (uint32_t j = 0; j < arguments.write; ++j) {
+			fputs(keys + j * stride, file);
+			fputc('\n', file);
+		}
+		if (fclose(file) != 0) {
+			perror(arguments.files[i]);
+			exit(1);
+		}
+	}
+	free(keys);
+}
+
+/* Every file gets a newline after it if it doesn't end with one, so the last
+   key of one file doesn't run into the first key of the next. */
+static void read_files(void)
+{
+	size_t capacity = 0;
+	for (size_t i = 0; i < arguments.file_count; ++i) {
+		int fd = open(arguments.files[i], O_RDONLY);
+		struct stat stat;
+		if (fd == -1 || fstat(fd, &stat) == -1) {
+			perror(arguments.files[i]);
+			exit(1);
+		}
+		capacity += stat.st_size + 1;
+		input = realloc(input, capacity);
+		assert(input != NULL);
+		size_t end = input_bytes + stat.st_size;
+		while (input_bytes < end) {
+			ssize_t bytes = read(fd, input + input_bytes, end - input_bytes);
+			if (bytes == -1) {
+				perror(arguments.files[i]);
+				exit(1);
+			}
+			if (bytes == 0) {
+				break;
+			}
+			input_bytes += bytes;
+		}
+		close(fd);
+		if (input_bytes > 0 && input[input_bytes - 1] != '\n') {
+			input[input_bytes++] = '\n';
+		}
+	}
+}
+
+/* Splits the input into `count` chunks of about the same size, moving
+   every boundary forward to the start of a key. */
+static void split_input(uint32_t count)
+{
+	chunks[0] = 0;
+	for (uint32_t i = 1; i < count; ++i) {
+		size_t offset = input_bytes / count * i;
+		if (offset < chunks[i - 1]) {
+			offset = chunks[i - 1];
+		}
+		while (offset < input_bytes && offset > 0
+		       && input[offset - 1] != '\n' && input[offset - 1] != 0) {
+			++offset;
+		}
+		chunks[i] = offset;
+	}
+	chunks[count] = input_bytes;
+}
+
+/* Runs the statement that follows for every key in the thread's chunk,
+   empty lines are skipped. */
+#define FOR_EACH_KEY(thread, key) \
+	for (char *key = input + chunks[thread], *key##_end = input + chunks[(thread) + 1]; \
+	     key < key##_end; key += strlen(key) + 1) \
+		if (*key != 0)
+
+void *run_parse(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t records = 0;
+	char *start = input + chunks[thread];
+	char *end = input + chunks[thread + 1];
+	for (char *c = start; c < end; ++c) {
+		if (*c == '\n') {
+			if (c > start && c[-1] != 0) {
+				++records;
+			}
+			*c = 0;
+		}
+		else if (*c == 0 && c > start && c[-1] != 0) {
+			++records;
+		}
+	}
+	chunk_records[thread] = records;
+	return NULL;
+}
+
+void *run_local(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	struct hash_table_base *local = hash_table_base_create();
+	FOR_EACH_KEY(thread, key) {
+		hash_table_base_fetch_add(local, key, 1);
+	}
+	locals[thread] = local;
+	return NULL;
+}
+
+/* The local table is walked bucket by bucket, and both tables use the
+   bernstein hash, so we go through the shared table's buckets in order
+   too. */
+void *run_merge(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	struct hash_table_base_iterator iterator;
+	hash_table_base_iterator_begin(&iterator, locals[thread]);
+	const char *key;
+	uint32_t count;
+	while (hash_table_base_iterator_next(&iterator, &key, &count)) {
+		hash_table_v2_fetch_add(shared, key, count);
+	}
+	hash_table_base_destroy(locals[thread]);
+	return NULL;
+}
+
+void *run_shared(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	FOR_EACH_KEY(thread, key) {
+		hash_table_v2_fetch_add(shared, key, 1);
+	}
+	return NULL;
+}
+
+struct key_count {
+	const char *key;
+	uint32_t count;
+};
+
+/* Returns the number of distinct keys in `shared`, and sets `total` to the
+   sum of their counts. */
+static uint64_t count_keys(uint64_t *total)
+{
+	struct hash_table_v2_iterator iterator;
+	hash_table_v2_iterator_begin(&iterator, shared);
+	const char *key;
+	uint32_t count;
+	uint64_t keys = 0;
+	*total = 0;
+	while (hash_table_v2_iterator_next(&iterator, &key, &count)) {
+		++keys;
+		*total += count;
+	}
+	hash_table_v2_iterator_end(&iterator);
+	return keys;
+}
+
+static int compare_key_counts(const void *a, const void *b)
+{
+	const struct key_count *x = a;
+	const struct key_count *y = b;
+	if (x->count != y->count) {
+		return x->count < y->count ? 1 : -1;
+	}
+	return strcmp(x->key, y->key);
+}
+
+static void print_top(uint64_t keys)
+{
+	struct key_count *key_counts = malloc((keys > 0 ? keys : 1) * sizeof(struct key_count));
+	assert(key_counts != NULL);
+	struct hash_table_v2_iterator iterator;
+	hash_table_v2_iterator_begin(&iterator, shared);
+	size_t count = 0;
+	while (count < keys
+	       && hash_table_v2_iterator_next(&iterator, &key_counts[count].key,
+	                                      &key_counts[count].count)) {
+		++count;
+	}
+	qsort(key_counts, count, sizeof(struct key_count), compare_key_counts);
+	for (size_t i = 0; i < count && i < arguments.top; ++i) {
+		printf("%10u %s\n", key_counts[i].count, key_counts[i].key);
+	}
+	hash_table_v2_iterator_end(&iterator);
+	free(key_counts);
+}
+
+/* Both ways of counting with `count` threads, the records were parsed with
+   the most threads. */
+static void run_aggregation(pthread_t *threads, uint32_t count, uint64_t records,
+                            bool verbose)
+{
+	split_input(count);
+
+	shared = hash_table_v2_create();
+	unsigned long local_usec = run_threads(threads, count, run_local);
+	unsigned long merge_usec = run_threads(threads, count, run_merge);
+	uint64_t total;
+	uint64_t keys = count_keys(&total);
+	if (verbose) {
+		printf("Pre-aggregated: %'lu usec (local %'lu usec, merge %'lu usec)\n",
+		       local_usec + merge_usec, local_usec, merge_usec);
+		printf("  - %'lu distinct keys, %'lu records counted\n", keys, total);
+		if (arguments.top > 0) {
+			print_top(keys);
+		}
+	}
+	else {
+		printf("  %u threads: pre-aggregated %'lu usec,", count,
+		       local_usec + merge_usec);
+	}
+	hash_table_v2_destroy(shared);
+	if (total != records) {
+		printf("  - counted %'lu records, but there are %'lu\n", total, records);
+	}
+
+	shared = hash_table_v2_create();
+	unsigned long shared_usec = run_threads(threads, count, run_shared);
+	keys = count_keys(&total);
+	if (verbose) {
+		printf("Shared table: %'lu usec\n", shared_usec);
+		printf("  - %'lu distinct keys, %'lu records counted\n", keys, total);
+	}
+	else {
+		printf(" shared %'lu usec\n", shared_usec);
+	}
+	hash_table_v2_destroy(shared);
+	if (total != records) {
+		printf("  - counted %'lu records, but there are %'lu\n", total, records);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	arguments.threads = 4;
+
+	static struct argp argp = { 0 };
+	argp.options = options;
+	argp.parser = parse_opt;
+	argp.args_doc = "FILE...";
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+	setlocale(LC_ALL, "en_US.UTF-8");
+
+	if (arguments.write > 0) {
+		uint64_t start = bench_nsec_now();
+		write_keys();
+		printf("Writing %'lu keys: %'lu usec\n",
+		       (uint64_t) arguments.write * arguments.file_count,
+		       usec_since(start));
+	}
+
+	uint64_t start = bench_nsec_now();
+	read_files();
+	printf("Reading %'lu bytes: %'lu usec\n", input_bytes, usec_since(start));
+
+	pthread_t *threads = calloc(arguments.threads, sizeof(pthread_t));
+	chunks = calloc(arguments.threads + 1, sizeof(size_t));
+	chunk_records = calloc(arguments.threads, sizeof(uint64_t));
+	locals = calloc(arguments.threads, sizeof(struct hash_table_base *));
+
+	split_input(arguments.threads);
+	unsigned long parse_usec = run_threads(threads, arguments.threads, run_parse);
+	uint64_t records = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		records += chunk_records[i];
+	}
+	printf("Parsing %'lu records: %'lu usec\n", records, parse_usec);
+
+	run_aggregation(threads, arguments.threads, records, true);
+
+	if (arguments.scaling) {
+		printf("Scaling:\n");
+		for (uint32_t count = 1; count <= arguments.threads; count *= 2) {
+			run_aggregation(threads, count, records, false);
+			if (count > UINT32_MAX / 2) {
+				break;
+			}
+		}
+	}
+
+	free(locals);
+	free(chunk_records);
+	free(chunks);
+	free(threads);
+	free(input);
+
+	return 0;
+}
@@ -1,28 +1,177 @@
+/* For pthread_attr_setaffinity_np */
+#define _GNU_SOURCE
+
 #include "hash-table-base.h"
+#include "hash-table-buffered.h"
+#include "hash-table-compact.h"
+#include "hash-table-cuckoo.h"
+#include "hash-table-int.h"
 #include "hash-table-v1.h"
 #include "hash-table-v2.h"
+#include "hash-table-v3.h"
+#include "hash-table-lockfree.h"
+#include "hash-table-mmap.h"
+#include "hash-table-resizable.h"
+#include "hash-table-snapshot.h"
+#include "hash-table-striped.h"
+#include "entry-arena.h"
+#include "bench.h"
+#include "perf-counters.h"
+#include "workload.h"
 
 #include <argp.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 char *entries;
 
 void (*add_entry)(void *, const char *key, uint32_t value);
 
-#define BYTES_PER_STRING 8
-
 struct arguments {
 	uint32_t threads;
 	uint32_t size;
+	bool scaling;
+	/* Whether `--read-ratio` was given, 0 is a ratio too. */
+	bool mixed;
+	uint32_t read_ratio;
+	const char *hash_name;
+	hash_function *hash;
+	bool hash_stats;
+	bool alloc_stats;
+	uint32_t batch;
+	bool churn;
+	bool bench;
+	uint32_t repeat;
+	uint32_t warmup;
+	bool pin;
+	enum bench_format format;
+	const char *workload_name;
+	enum workload_kind workload;
+	uint32_t key_length;
+	uint32_t overlap;
+	bool stripes_sweep;
+	bool perf;
+	const char *snapshot;
+	const char *mmap;
+	bool buffered;
+	uint32_t merge_threads;
+	enum hash_table_v2_lock lock;
+	bool lock_stats;
+	bool latency;
+	bool int_keys;
+	bool memory;
+	bool bulk;
+};
+
+/* Options without a short name use keys outside of the character range. */
+enum {
+	OPTION_SCALING = 0x100,
+	OPTION_READ_RATIO,
+	OPTION_HASH,
+	OPTION_HASH_STATS,
+	OPTION_ALLOC_STATS,
+	OPTION_BATCH,
+	OPTION_CHURN,
+	OPTION_BENCH,
+	OPTION_REPEAT,
+	OPTION_WARMUP,
+	OPTION_PIN,
+	OPTION_FORMAT,
+	OPTION_WORKLOAD,
+	OPTION_KEY_LENGTH,
+	OPTION_OVERLAP,
+	OPTION_STRIPES_SWEEP,
+	OPTION_PERF,
+	OPTION_SNAPSHOT,
+	OPTION_MMAP,
+	OPTION_BUFFERED,
+	OPTION_LOCK,
+	OPTION_LOCK_STATS,
+	OPTION_LATENCY,
+	OPTION_INT_KEYS,
+	OPTION_MEMORY,
+	OPTION_BULK,
 };
 
 static struct argp_option options[] = { 
 	{ "threads", 't', "NUM", 0, "Number of threads.", 0},
 	{ "size", 's', "NUM", 0, "Size per thread.", 0},
+	{ "scaling", OPTION_SCALING, 0, 0,
+	  "Also time every multithreaded table with 1, 2, 4, ... up to the "
+	  "number of threads.", 0},
+	{ "read-ratio", OPTION_READ_RATIO, "PCT", 0,
+	  "Also run v2 with lookups running alongside inserts, PCT percent of "
+	  "the operations being lookups.", 0},
+	{ "hash", OPTION_HASH, "NAME", 0,
+	  "Hash function for v2: bernstein (default), wyhash or crc32c.", 0},
+	{ "hash-stats", OPTION_HASH_STATS, 0, 0,
+	  "Report throughput and bucket occupancy of every hash function.", 0},
+	{ "alloc-stats", OPTION_ALLOC_STATS, 0, 0,
+	  "Report how much of the v2 insert time allocating entries takes.", 0},
+	{ "batch", OPTION_BATCH, "NUM", 0,
+	  "Also run v2 using the batch API with NUM keys per call.", 0},
+	{ "churn", OPTION_CHURN, 0, 0,
+	  "Also run v1 and v2 with a mix of lookups, inserts and removes.", 0},
+	{ "bench", OPTION_BENCH, 0, 0,
+	  "Only benchmark the inserts of every multithreaded table, repeating "
+	  "each run and reporting statistics.", 0},
+	{ "repeat", OPTION_REPEAT, "NUM", 0,
+	  "Timed repetitions of each benchmark (default 5).", 0},
+	{ "warmup", OPTION_WARMUP, "NUM", 0,
+	  "Untimed repetitions before the timed ones (default 1).", 0},
+	{ "pin", OPTION_PIN, 0, 0,
+	  "Pin every worker thread to its own CPU.", 0},
+	{ "format", OPTION_FORMAT, "FORMAT", 0,
+	  "Benchmark output: text (default), csv or json.", 0},
+	{ "workload", OPTION_WORKLOAD, "NAME", 0,
+	  "Keys to insert: uniform (default), zipf, sequential, prefix or "
+	  "adversarial.", 0},
+	{ "key-length", OPTION_KEY_LENGTH, "NUM", 0,
+	  "Letters per key (default 7).", 0},
+	{ "overlap", OPTION_OVERLAP, "PCT", 0,
+	  "Percentage of every thread's keys picked from all the threads' "
+	  "keys, so several threads insert them.", 0},
+	{ "stripes-sweep", OPTION_STRIPES_SWEEP, 0, 0,
+	  "Also time the striped table with 1, 2, 4, ... up to one lock per "
+	  "bucket.", 0},
+	{ "perf", OPTION_PERF, 0, 0,
+	  "Also count cycles, instructions, cache and branch misses and context "
+	  "switches per insert into every multithreaded table.", 0},
+	{ "snapshot", OPTION_SNAPSHOT, "PATH", 0,
+	  "Also write v2 to a snapshot file at PATH and time mapping it back.",
+	  0},
+	{ "mmap", OPTION_MMAP, "PATH", 0,
+	  "Also build the file-backed table at PATH (replacing the file) and "
+	  "compare opening it again against rebuilding v2.", 0},
+	{ "buffered", OPTION_BUFFERED, "NUM", 0,
+	  "Also insert into v2 through per-thread write buffers merged by NUM "
+	  "background threads (0 merges on the writers).", 0},
+	{ "lock", OPTION_LOCK, "NAME", 0,
+	  "Bucket lock for v2: mutex (default) or adaptive.", 0},
+	{ "lock-stats", OPTION_LOCK_STATS, 0, 0,
+	  "Also run v2 with adaptive locks and report how contended they "
+	  "were.", 0},
+	{ "latency", OPTION_LATENCY, 0, 0,
+	  "Also time every lookup in v2 and the cuckoo table and report the "
+	  "tail latencies, alone and with writers running.", 0},
+	{ "int-keys", OPTION_INT_KEYS, 0, 0,
+	  "Also run the tables generated for uint64_t keys and 16 byte keys "
+	  "against v2.", 0},
+	{ "memory", OPTION_MEMORY, 0, 0,
+	  "Also report how much memory every table takes, empty and with all "
+	  "the keys.", 0},
+	{ "bulk", OPTION_BULK, 0, 0,
+	  "Also build v2 with hash_table_v2_bulk_build and compare it to "
+	  "inserting with locks.", 0},
 	{ 0 } 
 };
 
@@ -73,29 +222,205 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 	case 's':
 		arguments->size = parse_uint32_t(arg);
 		break;
+	case OPTION_SCALING:
+		arguments->scaling = true;
+		break;
+	case OPTION_READ_RATIO:
+		arguments->mixed = true;
+		arguments->read_ratio = parse_uint32_t(arg);
+		if (arguments->read_ratio > 100) {
+			argp_error(state, "read ratio is a percentage");
+		}
+		break;
+	case OPTION_HASH:
+		arguments->hash_name = arg;
+		arguments->hash = hash_function_find(arg);
+		if (arguments->hash == NULL) {
+			argp_error(state, "unknown hash function '%s'", arg);
+		}
+		break;
+	case OPTION_HASH_STATS:
+		arguments->hash_stats = true;
+		break;
+	case OPTION_ALLOC_STATS:
+		arguments->alloc_stats = true;
+		break;
+	case OPTION_BATCH:
+		arguments->batch = parse_uint32_t(arg);
+		break;
+	case OPTION_CHURN:
+		arguments->churn = true;
+		break;
+	case OPTION_BENCH:
+		arguments->bench = true;
+		break;
+	case OPTION_REPEAT:
+		arguments->repeat = parse_uint32_t(arg);
+		if (arguments->repeat == 0) {
+			argp_error(state, "need at least one repetition");
+		}
+		break;
+	case OPTION_WARMUP:
+		arguments->warmup = parse_uint32_t(arg);
+		break;
+	case OPTION_PIN:
+		arguments->pin = true;
+		break;
+	case OPTION_FORMAT:
+		if (!bench_format_parse(arg, &arguments->format)) {
+			argp_error(state, "unknown format '%s'", arg);
+		}
+		break;
+	case OPTION_WORKLOAD:
+		arguments->workload_name = arg;
+		if (!workload_kind_parse(arg, &arguments->workload)) {
+			argp_error(state, "unknown workload '%s'", arg);
+		}
+		break;
+	case OPTION_KEY_LENGTH:
+		arguments->key_length = parse_uint32_t(arg);
+		if (arguments->key_length == 0) {
+			argp_error(state, "keys need at least one letter");
+		}
+		break;
+	case OPTION_OVERLAP:
+		arguments->overlap = parse_uint32_t(arg);
+		if (arguments->overlap > 100) {
+			argp_error(state, "overlap is a percentage");
+		}
+		break;
+	case OPTION_STRIPES_SWEEP:
+		arguments->stripes_sweep = true;
+		break;
+	case OPTION_PERF:
+		arguments->perf = true;
+		break;
+	case OPTION_SNAPSHOT:
+		arguments->snapshot = arg;
+		break;
+	case OPTION_MMAP:
+		arguments->mmap = arg;
+		break;
+	case OPTION_BUFFERED:
+		arguments->buffered = true;
+		arguments->merge_threads = parse_uint32_t(arg);
+		break;
+	case OPTION_LOCK:
+		if (strcmp(arg, "mutex") == 0) {
+			arguments->lock = HASH_TABLE_V2_LOCK_MUTEX;
+		}
+		else if (strcmp(arg, "adaptive") == 0) {
+			arguments->lock = HASH_TABLE_V2_LOCK_ADAPTIVE;
+		}
+		else {
+			argp_error(state, "unknown lock '%s'", arg);
+		}
+		break;
+	case OPTION_LOCK_STATS:
+		arguments->lock_stats = true;
+		break;
+	case OPTION_LATENCY:
+		arguments->latency = true;
+		break;
+	case OPTION_INT_KEYS:
+		arguments->int_keys = true;
+		break;
+	case OPTION_MEMORY:
+		arguments->memory = true;
+		break;
+	case OPTION_BULK:
+		arguments->bulk = true;
+		break;
+	case ARGP_KEY_END:
+		if (arguments->key_length < workload_min_key_length(arguments->workload)) {
+			argp_error(state, "%s keys need at least %u letters",
+			           workload_kind_name(arguments->workload),
+			           workload_min_key_length(arguments->workload));
+		}
+		break;
 	}   
 	return 0;
 }
 
 static struct arguments arguments;
 static char *data;
+static size_t data_bytes;
+static size_t bytes_per_string;
+static struct workload workload;
 
 static size_t get_global_index(uint32_t thread, uint32_t index)
 {
-	return thread * arguments.size + index;
+	return (size_t) thread * arguments.size + index;
 }
 
 static char *get_string(size_t global_index)
 {
-	return data + (global_index * BYTES_PER_STRING);
+	return data + (global_index * bytes_per_string);
+}
+
+static unsigned long usec_since(uint64_t start)
+{
+	return (bench_nsec_now() - start) / 1000;
+}
+
+/* The CPUs we're allowed to run on, thread `i` gets pinned to the
+   `i % cpu_count`-th of them. */
+static int *cpus;
+static uint32_t cpu_count;
+
+static void find_cpus(void)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		perror("sched_getaffinity");
+		exit(1);
+	}
+	cpus = calloc(CPU_COUNT(&set), sizeof(int));
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &set)) {
+			cpus[cpu_count++] = cpu;
+		}
+	}
+}
+
+/* Runs `run` on `count` new threads, passing each its thread number, and
+   returns the time in nanoseconds until all of them finish. */
+static uint64_t run_threads_nsec(pthread_t *threads, uint32_t count,
+                                 void *(*run)(void *))
+{
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	uint64_t start = bench_nsec_now();
+	for (uintptr_t i = 0; i < count; ++i) {
+		if (arguments.pin) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i % cpu_count], &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		int err = pthread_create(&threads[i], &attr, run, (void*) i);
+		if (err != 0) {
+			printf("pthread_create returned %d\n", err);
+			exit(err);
+		}
+	}
+	for (uintptr_t i = 0; i < count; ++i) {
+		int err = pthread_join(threads[i], NULL);
+		if (err != 0) {
+			printf("pthread_join returned %d\n", err);
+			exit(err);
+		}
+	}
+	uint64_t nsec = bench_nsec_now() - start;
+	pthread_attr_destroy(&attr);
+	return nsec;
 }
 
-static unsigned long usec_diff(struct timeval *a, struct timeval *b)
+static unsigned long run_threads(pthread_t *threads, uint32_t count,
+                                 void *(*run)(void *))
 {
-	unsigned long usec;
-	usec = (b->tv_sec - a->tv_sec)*1000000;
-	usec += b->tv_usec - a->tv_usec;
-	return usec;
+	return run_threads_nsec(threads, count, run) / 1000;
 }
 
 static struct hash_table_v1 *hash_table_v1;
@@ -122,136 +447,1657 @@ void *run_v2(void *arg) {
 	return NULL;
 }
 
-int main(int argc, char *argv[]) {
-	arguments.threads = 4;
-	arguments.size = 25000;
-  
-	// static struct argp argp = { options, parse_opt };
-	static struct argp argp = { 0 };
-	argp.options = options;
-	argp.parser = parse_opt;
-	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+static struct hash_table_v3 *hash_table_v3;
 
-	setlocale(LC_ALL, "en_US.UTF-8");
+void *run_v3(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_v3_add_entry(hash_table_v3, string, global_index);
+	}
+	return NULL;
+}
 
-	data = calloc(arguments.threads * arguments.size, BYTES_PER_STRING);
+static struct hash_table_lockfree *hash_table_lockfree;
+
+void *run_lockfree(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_lockfree_add_entry(hash_table_lockfree, string, global_index);
+	}
+	return NULL;
+}
 
-	struct timeval start, end;
+static struct hash_table_resizable *hash_table_resizable;
+static uint64_t *worst_insert_nsec;
 
-	gettimeofday(&start, NULL);
-	srand(42);
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			for (uint32_t k = 0; k < (BYTES_PER_STRING - 1); ++k) {
-				int r = rand() % 52;
-				if (r < 26) {
-					string[k] = r + 0x41;
-				}
-				else {
-					string[k] = r + 0x47;
-				}
+/* Besides the total time we want to know how long the slowest single insert
+   took, since that's where a rehash would show up. */
+void *run_resizable(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t worst = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		uint64_t start = bench_nsec_now();
+		hash_table_resizable_add_entry(hash_table_resizable, string, global_index);
+		uint64_t elapsed = bench_nsec_now() - start;
+		if (elapsed > worst) {
+			worst = elapsed;
+		}
+	}
+	worst_insert_nsec[thread] = worst;
+	return NULL;
+}
+
+static struct hash_table_cuckoo *hash_table_cuckoo;
+
+void *run_cuckoo(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_cuckoo_add_entry(hash_table_cuckoo, string, global_index);
+	}
+	return NULL;
+}
+
+static struct hash_table_compact *hash_table_compact;
+
+void *run_compact(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_compact_add_entry(hash_table_compact, string, global_index);
+	}
+	return NULL;
+}
+
+/* A xorshift64* generator, every thread keeps its own state so picking an
+   operation doesn't synchronize threads like `rand` would. */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t *mixed_lookups;
+
+/* The table already holds the first half of every thread's keys. Each
+   thread does `size` operations, either looking up one of those keys at
+   random, or inserting the next key of its own second half. */
+void *run_v2_mixed(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t state = 0x9E3779B97F4A7C15ULL * (thread + 1);
+	uint32_t half = arguments.size / 2;
+	uint32_t next_insert = half;
+	uint64_t lookups = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		uint64_t r = next_random(&state);
+		if (half > 0 && r % 100 < arguments.read_ratio) {
+			uint32_t other = (r >> 32) % arguments.threads;
+			size_t global_index = get_global_index(other, (r >> 8) % half);
+			hash_table_v2_contains(hash_table_v2, get_string(global_index));
+			++lookups;
+		}
+		else {
+			size_t global_index = get_global_index(thread, next_insert);
+			hash_table_v2_add_entry(hash_table_v2, get_string(global_index),
+			                        global_index);
+			if (++next_insert == arguments.size) {
+				next_insert = half;
 			}
-			string[BYTES_PER_STRING - 1] = 0;
 		}
 	}
-	gettimeofday(&end, NULL);
-	printf("Generation: %'lu usec\n", usec_diff(&start, &end));
+	mixed_lookups[thread] = lookups;
+	return NULL;
+}
 
-	struct hash_table_base *hash_table_base = hash_table_base_create();
-	gettimeofday(&start, NULL);
+static struct hash_table_v2 *create_v2(void)
+{
+	struct hash_table_v2_options options = { 0 };
+	options.hash = arguments.hash;
+	options.lock = arguments.lock;
+	return hash_table_v2_create_with_options(&options);
+}
+
+static void run_mixed(pthread_t *threads)
+{
+	hash_table_v2 = create_v2();
 	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
+		for (uint32_t j = 0; j < arguments.size / 2; ++j) {
 			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			hash_table_base_add_entry(hash_table_base, string, global_index);
+			hash_table_v2_add_entry(hash_table_v2, get_string(global_index),
+			                        global_index);
 		}
 	}
-	gettimeofday(&end, NULL);
-	printf("Hash table base: %'lu usec\n", usec_diff(&start, &end));
 
-	size_t missing = 0;
+	mixed_lookups = calloc(arguments.threads, sizeof(uint64_t));
+	unsigned long usec = run_threads(threads, arguments.threads, run_v2_mixed);
+	uint64_t lookups = 0;
 	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			if (!hash_table_base_contains(hash_table_base, string)) {
-				++missing;
+		lookups += mixed_lookups[i];
+	}
+	free(mixed_lookups);
+	uint64_t operations = (uint64_t) arguments.threads * arguments.size;
+
+	printf("Hash table v2 mixed (%u%% lookups): %'lu usec\n",
+	       arguments.read_ratio, usec);
+	printf("  - %'lu lookups, %'lu inserts\n", lookups, operations - lookups);
+	if (usec > 0) {
+		printf("  - %'lu lookups/sec, %'lu operations/sec\n",
+		       lookups * 1000000 / usec, operations * 1000000 / usec);
+	}
+	hash_table_v2_destroy(hash_table_v2);
+}
+
+/* Times every hash function over all the keys, then counts how many keys
+   land in each of the `HASH_TABLE_CAPACITY` buckets, which is the length
+   every chain would have in the tables. */
+static void run_hash_stats(void)
+{
+	size_t keys = (size_t) arguments.threads * arguments.size;
+	uint32_t *chain_lengths = calloc(HASH_TABLE_CAPACITY, sizeof(uint32_t));
+
+	printf("Hash functions (%'lu keys):\n", keys);
+	for (size_t i = 0; i < hash_functions_count; ++i) {
+		const struct hash_function_info *info = &hash_functions[i];
+
+		uint32_t combined = 0;
+		uint64_t start = bench_nsec_now();
+		for (size_t j = 0; j < keys; ++j) {
+			combined ^= info->function(get_string(j));
+		}
+		unsigned long usec = usec_since(start);
+		/* Use the result, so the loop can't be optimized away */
+		__asm__ volatile("" : : "r"(combined));
+
+		memset(chain_lengths, 0, HASH_TABLE_CAPACITY * sizeof(uint32_t));
+		for (size_t j = 0; j < keys; ++j) {
+			++chain_lengths[info->function(get_string(j)) % HASH_TABLE_CAPACITY];
+		}
+		uint32_t longest = 0;
+		size_t empty = 0;
+		/* A successful lookup of the n-th key in a chain compares n keys */
+		double compares = 0;
+		for (size_t j = 0; j < HASH_TABLE_CAPACITY; ++j) {
+			uint32_t length = chain_lengths[j];
+			if (length > longest) {
+				longest = length;
 			}
+			if (length == 0) {
+				++empty;
+			}
+			compares += (double) length * (length + 1) / 2;
+		}
+		double average = 0;
+		if (empty < HASH_TABLE_CAPACITY) {
+			average = (double) keys / (HASH_TABLE_CAPACITY - empty);
+		}
+
+		printf("  %s: %'lu usec", info->name, usec);
+		if (usec > 0) {
+			printf(" (%'lu hashes/usec)", keys / usec);
+		}
+		printf("\n    - chain length max %'u, average %.2f, %'lu empty buckets\n",
+		       longest, average, empty);
+		if (keys > 0) {
+			printf("    - %.2f compares per lookup\n", compares / keys);
 		}
 	}
-	printf("  - %'lu missing\n", missing);
-	hash_table_base_destroy(hash_table_base);
+	free(chain_lengths);
+}
 
-	pthread_t *threads = calloc(arguments.threads, sizeof(pthread_t));
+static void ***alloc_objects;
+/* What a v2 entry takes, set before the runs. */
+static size_t alloc_object_size;
+static struct entry_arena alloc_arena;
 
-	hash_table_v1 = hash_table_v1_create();
-	gettimeofday(&start, NULL);
-	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_create(&threads[i], NULL, run_v1, (void*) i);
-		if (err != 0) {
-			printf("pthread_create returned %d\n", err);
-			return err;
-		}
+/* Both allocation runs make exactly the allocations the v2 inserts do, the
+   `calloc` one keeps its objects around until after it's timed, like the
+   hash table would. */
+void *run_alloc_calloc(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	void **objects = alloc_objects[thread];
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		objects[j] = calloc(1, alloc_object_size);
 	}
-	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_join(threads[i], NULL);
-		if (err != 0) {
-			printf("pthread_join returned %d\n", err);
-			return err;
-		}
+	return NULL;
+}
+
+void *run_alloc_arena(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	void **objects = alloc_objects[thread];
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		objects[j] = entry_arena_alloc(&alloc_arena);
 	}
-	gettimeofday(&end, NULL);
-	printf("Hash table v1: %'lu usec\n", usec_diff(&start, &end));
+	return NULL;
+}
 
-	missing = 0;
+static void run_alloc_stats(pthread_t *threads, unsigned long insert_usec)
+{
+	alloc_object_size = hash_table_v2_entry_size();
+	alloc_objects = calloc(arguments.threads, sizeof(void **));
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		alloc_objects[i] = calloc(arguments.size, sizeof(void *));
+	}
+
+	unsigned long calloc_usec = run_threads(threads, arguments.threads,
+	                                        run_alloc_calloc);
 	for (uint32_t i = 0; i < arguments.threads; ++i) {
 		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			if (!hash_table_v1_contains(hash_table_v1, string)) {
-				++missing;
-			}
+			free(alloc_objects[i][j]);
 		}
 	}
-	printf("  - %'lu missing\n", missing);
-	hash_table_v1_destroy(hash_table_v1);
 
-	hash_table_v2 = hash_table_v2_create();
-	gettimeofday(&start, NULL);
-	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_create(&threads[i], NULL, run_v2, (void*) i);
-		if (err != 0) {
-			printf("pthread_create returned %d\n", err);
-			return err;
+	entry_arena_init(&alloc_arena, alloc_object_size);
+	unsigned long arena_usec = run_threads(threads, arguments.threads,
+	                                       run_alloc_arena);
+	entry_arena_destroy(&alloc_arena);
+
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		free(alloc_objects[i]);
+	}
+	free(alloc_objects);
+
+	printf("  - allocating with calloc: %'lu usec", calloc_usec);
+	if (insert_usec > 0) {
+		printf(" (%.1f%% of insert time)",
+		       100.0 * calloc_usec / insert_usec);
+	}
+	printf("\n  - allocating with arena: %'lu usec", arena_usec);
+	if (insert_usec > 0) {
+		printf(" (%.1f%% of insert time)",
+		       100.0 * arena_usec / insert_usec);
+	}
+	printf("\n");
+}
+
+static uint64_t *batch_missing;
+
+/* Hands the thread's keys to `hash_table_v2_add_batch` `batch` at a time. */
+void *run_v2_batch(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	const char **keys = calloc(arguments.batch, sizeof(char *));
+	uint32_t *values = calloc(arguments.batch, sizeof(uint32_t));
+	for (uint32_t j = 0; j < arguments.size; j += arguments.batch) {
+		uint32_t count = 0;
+		for (; count < arguments.batch && j + count < arguments.size; ++count) {
+			size_t global_index = get_global_index(thread, j + count);
+			keys[count] = get_string(global_index);
+			values[count] = global_index;
 		}
+		hash_table_v2_add_batch(hash_table_v2, keys, values, count);
 	}
-	for (uintptr_t i = 0; i < arguments.threads; ++i) {
-		int err = pthread_join(threads[i], NULL);
-		if (err != 0) {
-			printf("pthread_join returned %d\n", err);
-			return err;
+	free(keys);
+	free(values);
+	return NULL;
+}
+
+void *run_v2_lookup(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		if (!hash_table_v2_contains(hash_table_v2, get_string(global_index))) {
+			++missing;
 		}
 	}
-	gettimeofday(&end, NULL);
-	printf("Hash table v2: %'lu usec\n", usec_diff(&start, &end));
+	batch_missing[thread] = missing;
+	return NULL;
+}
 
-	missing = 0;
-	for (uint32_t i = 0; i < arguments.threads; ++i) {
-		for (uint32_t j = 0; j < arguments.size; ++j) {
-			size_t global_index = get_global_index(i, j);
-			char *string = get_string(global_index);
-			if (!hash_table_v2_contains(hash_table_v2, string)) {
+void *run_v2_lookup_batch(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	const char **keys = calloc(arguments.batch, sizeof(char *));
+	bool *results = calloc(arguments.batch, sizeof(bool));
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; j += arguments.batch) {
+		uint32_t count = 0;
+		for (; count < arguments.batch && j + count < arguments.size; ++count) {
+			keys[count] = get_string(get_global_index(thread, j + count));
+		}
+		hash_table_v2_contains_batch(hash_table_v2, keys, count, results);
+		for (uint32_t k = 0; k < count; ++k) {
+			if (!results[k]) {
 				++missing;
 			}
 		}
 	}
+	free(keys);
+	free(results);
+	batch_missing[thread] = missing;
+	return NULL;
+}
+
+/* Each side is timed on its own, single inserts on a table of their own,
+   so the speedup is what batching buys over the calls it replaces. */
+static void run_batch(pthread_t *threads)
+{
+	hash_table_v2 = create_v2();
+	unsigned long single_insert_usec = run_threads(threads, arguments.threads,
+	                                               run_v2);
+	hash_table_v2_destroy(hash_table_v2);
+
+	hash_table_v2 = create_v2();
+	unsigned long batch_insert_usec = run_threads(threads, arguments.threads,
+	                                              run_v2_batch);
+
+	batch_missing = calloc(arguments.threads, sizeof(uint64_t));
+	unsigned long single_usec = run_threads(threads, arguments.threads,
+	                                        run_v2_lookup);
+	unsigned long batch_usec = run_threads(threads, arguments.threads,
+	                                       run_v2_lookup_batch);
+	uint64_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		missing += batch_missing[i];
+	}
+	free(batch_missing);
+	printf("Hash table v2 (batches of %'u):\n", arguments.batch);
+	printf("  - inserts: %'lu usec one at a time, %'lu usec in batches (%.2fx)\n",
+	       single_insert_usec, batch_insert_usec,
+	       (double) single_insert_usec / batch_insert_usec);
+	printf("  - lookups: %'lu usec one at a time, %'lu usec in batches (%.2fx)\n",
+	       single_usec, batch_usec, (double) single_usec / batch_usec);
 	printf("  - %'lu missing\n", missing);
 	hash_table_v2_destroy(hash_table_v2);
+}
+
+struct churn_counts {
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t inserts;
+	uint64_t removes;
+	uint64_t removed;
+};
+
+static struct churn_counts *churn_counts;
+
+/* The tables `--churn` runs, all of them support removes. */
+struct churn_ops {
+	const char *name;
+	void *(*create)(void);
+	bool (*contains)(void *, const char *key);
+	void (*add_entry)(void *, const char *key, uint32_t value);
+	bool (*remove)(void *, const char *key);
+	void (*memory_usage)(void *, struct hash_table_memory_usage *usage);
+	void (*destroy)(void *);
+};
+
+static void *create_v1_churn(void)
+{
+	return hash_table_v1_create();
+}
+
+static void *create_v2_churn(void)
+{
+	return create_v2();
+}
+
+#define CHURN_OPS(name, prefix) { \
+	name, \
+	create_##prefix##_churn, \
+	(bool (*)(void *, const char *)) hash_table_##prefix##_contains, \
+	(void (*)(void *, const char *, uint32_t)) hash_table_##prefix##_add_entry, \
+	(bool (*)(void *, const char *)) hash_table_##prefix##_remove, \
+	(void (*)(void *, struct hash_table_memory_usage *)) hash_table_##prefix##_memory_usage, \
+	(void (*)(void *)) hash_table_##prefix##_destroy, \
+}
+
+static const struct churn_ops churn_tables[] = {
+	CHURN_OPS("v1", v1),
+	CHURN_OPS("v2", v2),
+};
+
+static const struct churn_ops *churn_ops;
+static void *churn_table;
+
+/* Half of the operations look up a key of any thread, a quarter insert one
+   of the thread's own keys and the rest remove one. Only the owning thread
+   inserts or removes a key, but lookups from other threads race with both. */
+void *run_churn_table(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t state = 0x9E3779B97F4A7C15ULL * (thread + 1);
+	struct churn_counts counts = { 0 };
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		uint64_t r = next_random(&state);
+		uint32_t operation = r % 100;
+		uint32_t index = (r >> 8) % arguments.size;
+		if (operation < 50) {
+			uint32_t other = (r >> 40) % arguments.threads;
+			char *string = get_string(get_global_index(other, index));
+			if (churn_ops->contains(churn_table, string)) {
+				++counts.hits;
+			}
+			++counts.lookups;
+		}
+		else if (operation < 75) {
+			size_t global_index = get_global_index(thread, index);
+			churn_ops->add_entry(churn_table, get_string(global_index),
+			                     global_index);
+			++counts.inserts;
+		}
+		else {
+			char *string = get_string(get_global_index(thread, index));
+			if (churn_ops->remove(churn_table, string)) {
+				++counts.removed;
+			}
+			++counts.removes;
+		}
+	}
+	churn_counts[thread] = counts;
+	return NULL;
+}
+
+/* Each table churns twice. Removed entries are reused, so the second round
+   shouldn't need more entry memory than the first. */
+static void run_churn(pthread_t *threads)
+{
+	for (size_t t = 0; t < sizeof(churn_tables) / sizeof(churn_tables[0]); ++t) {
+		churn_ops = &churn_tables[t];
+		churn_table = churn_ops->create();
+		for (int round = 0; round < 2; ++round) {
+			churn_counts = calloc(arguments.threads, sizeof(struct churn_counts));
+			unsigned long usec = run_threads(threads, arguments.threads,
+			                                 run_churn_table);
+
+			struct churn_counts total = { 0 };
+			for (uint32_t i = 0; i < arguments.threads; ++i) {
+				total.lookups += churn_counts[i].lookups;
+				total.hits += churn_counts[i].hits;
+				total.inserts += churn_counts[i].inserts;
+				total.removes += churn_counts[i].removes;
+				total.removed += churn_counts[i].removed;
+			}
+			free(churn_counts);
+
+			struct hash_table_memory_usage usage;
+			churn_ops->memory_usage(churn_table, &usage);
+			printf("Hash table %s churn, round %d: %'lu usec\n",
+			       churn_ops->name, round + 1, usec);
+			printf("  - %'lu lookups (%'lu found), %'lu inserts, %'lu removes (%'lu removed)\n",
+			       total.lookups, total.hits, total.inserts, total.removes,
+			       total.removed);
+			printf("  - %'zu keys, %'zu bytes of entries\n", usage.keys,
+			       usage.entry_bytes);
+		}
+		churn_ops->destroy(churn_table);
+	}
+}
+
+/* For the modes that compare several tables we go through `add_entry` on an
+   untyped `table`, every table has the same shape of API. */
+static void *table;
+
+void *run_add_entry(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		add_entry(table, string, global_index);
+	}
+	return NULL;
+}
+
+struct table_ops {
+	const char *name;
+	void *(*create)();
+	void (*add_entry)(void *, const char *key, uint32_t value);
+	void (*memory_usage)(void *, struct hash_table_memory_usage *usage);
+	void (*destroy)(void *);
+};
+
+#define TABLE_OPS(name, prefix) { \
+	name, \
+	(void *(*)()) prefix##_create, \
+	(void (*)(void *, const char *, uint32_t)) prefix##_add_entry, \
+	(void (*)(void *, struct hash_table_memory_usage *)) prefix##_memory_usage, \
+	(void (*)(void *)) prefix##_destroy, \
+}
+
+static const struct table_ops tables[] = {
+	TABLE_OPS("v1", hash_table_v1),
+	TABLE_OPS("v2", hash_table_v2),
+	TABLE_OPS("v3", hash_table_v3),
+	TABLE_OPS("lock-free", hash_table_lockfree),
+	TABLE_OPS("resizable", hash_table_resizable),
+	TABLE_OPS("striped", hash_table_striped),
+	TABLE_OPS("cuckoo", hash_table_cuckoo),
+	TABLE_OPS("compact", hash_table_compact),
+};
+
+#define TABLES_COUNT (sizeof(tables) / sizeof(tables[0]))
+
+/* Every thread still inserts `size` entries, so with perfect scaling each
+   row would take the same time. */
+static void run_scaling(pthread_t *threads)
+{
+	printf("Scaling (%'u entries per thread):\n", arguments.size);
+	for (uint32_t count = 1; count <= arguments.threads; count *= 2) {
+		printf("  %u threads:", count);
+		for (size_t i = 0; i < TABLES_COUNT; ++i) {
+			const struct table_ops *ops = &tables[i];
+			table = ops->create();
+			add_entry = ops->add_entry;
+			unsigned long usec = run_threads(threads, count, run_add_entry);
+			ops->destroy(table);
+			printf("%s %s %'lu usec", i == 0 ? "" : ",", ops->name, usec);
+		}
+		printf("\n");
+		if (count > UINT32_MAX / 2) {
+			break;
+		}
+	}
+}
+
+static struct hash_table_striped *hash_table_striped;
+static uint64_t *striped_missing;
+
+void *run_striped(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_striped_add_entry(hash_table_striped, string, global_index);
+	}
+	return NULL;
+}
+
+void *run_striped_lookup(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		if (!hash_table_striped_contains(hash_table_striped, get_string(global_index))) {
+			++missing;
+		}
+	}
+	striped_missing[thread] = missing;
+	return NULL;
+}
+
+/* Fewer stripes take less memory but make more operations wait on each
+   other, inserts need the lock to themselves while lookups only share it. */
+static void run_stripes_sweep(pthread_t *threads)
+{
+	striped_missing = calloc(arguments.threads, sizeof(uint64_t));
+	printf("Stripes (%'u threads, %'u entries per thread):\n",
+	       arguments.threads, arguments.size);
+	for (uint32_t stripes = 1; stripes <= HASH_TABLE_CAPACITY; stripes *= 2) {
+		hash_table_striped = hash_table_striped_create_with_stripes(stripes);
+		unsigned long insert_usec = run_threads(threads, arguments.threads,
+		                                        run_striped);
+		unsigned long lookup_usec = run_threads(threads, arguments.threads,
+		                                        run_striped_lookup);
+		uint64_t missing = 0;
+		for (uint32_t i = 0; i < arguments.threads; ++i) {
+			missing += striped_missing[i];
+		}
+		printf("  %'u stripes (%'lu bytes of locks): insert %'lu usec, "
+		       "lookup %'lu usec, %'lu missing\n",
+		       stripes, hash_table_striped_lock_bytes(hash_table_striped),
+		       insert_usec, lookup_usec, missing);
+		hash_table_striped_destroy(hash_table_striped);
+	}
+	free(striped_missing);
+}
+
+static struct hash_table_snapshot *hash_table_snapshot;
+static uint64_t *snapshot_missing;
+
+void *run_snapshot_lookup(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		if (!hash_table_snapshot_contains(hash_table_snapshot, get_string(global_index))) {
+			++missing;
+		}
+	}
+	snapshot_missing[thread] = missing;
+	return NULL;
+}
+
+/* A warm restart is opening the snapshot instead of inserting everything
+   again, so we compare it against the time the build took. */
+static void run_snapshot(pthread_t *threads)
+{
+	hash_table_v2 = create_v2();
+	unsigned long build_usec = run_threads(threads, arguments.threads, run_v2);
+	uint64_t start = bench_nsec_now();
+	bool written = hash_table_v2_snapshot(hash_table_v2, arguments.snapshot);
+	unsigned long write_usec = usec_since(start);
+	hash_table_v2_destroy(hash_table_v2);
+	if (!written) {
+		printf("Snapshot: couldn't write %s: %s\n", arguments.snapshot,
+		       strerror(errno));
+		return;
+	}
+
+	start = bench_nsec_now();
+	hash_table_snapshot = hash_table_snapshot_open(arguments.snapshot);
+	unsigned long open_usec = usec_since(start);
+	if (hash_table_snapshot == NULL) {
+		printf("Snapshot: couldn't open %s: %s\n", arguments.snapshot,
+		       strerror(errno));
+		return;
+	}
+
+	snapshot_missing = calloc(arguments.threads, sizeof(uint64_t));
+	unsigned long lookup_usec = run_threads(threads, arguments.threads,
+	                                        run_snapshot_lookup);
+	uint64_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		missing += snapshot_missing[i];
+	}
+	free(snapshot_missing);
+
+	printf("Snapshot (%'lu entries, %'lu bytes):\n",
+	       hash_table_snapshot_size(hash_table_snapshot),
+	       hash_table_snapshot_bytes(hash_table_snapshot));
+	printf("  - build %'lu usec, write %'lu usec, open %'lu usec\n",
+	       build_usec, write_usec, open_usec);
+	printf("  - lookups: %'lu usec\n", lookup_usec);
+	printf("  - %'lu missing\n", missing);
+	hash_table_snapshot_close(hash_table_snapshot);
+}
+
+static struct hash_table_mmap *hash_table_mmap;
+static uint64_t *mmap_missing;
+/* The `errno` of the insert that stopped each thread, or 0. */
+static int *mmap_errors;
+
+void *run_mmap(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		if (!hash_table_mmap_add_entry(hash_table_mmap, string, global_index)) {
+			mmap_errors[thread] = errno;
+			break;
+		}
+	}
+	return NULL;
+}
+
+void *run_mmap_lookup(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		if (!hash_table_mmap_contains(hash_table_mmap, get_string(global_index))) {
+			++missing;
+		}
+	}
+	mmap_missing[thread] = missing;
+	return NULL;
+}
+
+/* Before opening the file again we ask the kernel to drop its pages from
+   the page cache, they're clean after the sync. That's only a hint, so the
+   open may still find some of them cached. */
+static void run_mmap_table(pthread_t *threads)
+{
+	unlink(arguments.mmap);
+	hash_table_mmap = hash_table_mmap_open(arguments.mmap);
+	if (hash_table_mmap == NULL) {
+		printf("Hash table mmap: couldn't open %s: %s\n", arguments.mmap,
+		       strerror(errno));
+		return;
+	}
+	mmap_errors = calloc(arguments.threads, sizeof(int));
+	unsigned long build_usec = run_threads(threads, arguments.threads, run_mmap);
+	int error = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		if (mmap_errors[i] != 0) {
+			error = mmap_errors[i];
+		}
+	}
+	free(mmap_errors);
+	if (error != 0) {
+		printf("Hash table mmap: couldn't grow %s: %s\n", arguments.mmap,
+		       strerror(error));
+		hash_table_mmap_close(hash_table_mmap);
+		return;
+	}
+	uint64_t start = bench_nsec_now();
+	bool synced = hash_table_mmap_sync(hash_table_mmap);
+	unsigned long sync_usec = usec_since(start);
+	size_t bytes = hash_table_mmap_bytes(hash_table_mmap);
+	hash_table_mmap_close(hash_table_mmap);
+	if (!synced) {
+		printf("Hash table mmap: couldn't sync %s: %s\n", arguments.mmap,
+		       strerror(errno));
+		return;
+	}
+
+	int fd = open(arguments.mmap, O_RDONLY);
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+
+	start = bench_nsec_now();
+	hash_table_mmap = hash_table_mmap_open(arguments.mmap);
+	unsigned long open_usec = usec_since(start);
+	if (hash_table_mmap == NULL) {
+		printf("Hash table mmap: couldn't reopen %s: %s\n", arguments.mmap,
+		       strerror(errno));
+		return;
+	}
+	mmap_missing = calloc(arguments.threads, sizeof(uint64_t));
+	unsigned long lookup_usec = run_threads(threads, arguments.threads,
+	                                        run_mmap_lookup);
+	uint64_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		missing += mmap_missing[i];
+	}
+	free(mmap_missing);
+	size_t size = hash_table_mmap_size(hash_table_mmap);
+	hash_table_mmap_close(hash_table_mmap);
+
+	hash_table_v2 = create_v2();
+	unsigned long rebuild_usec = run_threads(threads, arguments.threads, run_v2);
+	hash_table_v2_destroy(hash_table_v2);
+
+	printf("Hash table mmap (%'lu entries, %'lu bytes): %'lu usec\n",
+	       size, bytes, build_usec);
+	printf("  - sync %'lu usec\n", sync_usec);
+	printf("  - cold open %'lu usec, then first lookups %'lu usec\n",
+	       open_usec, lookup_usec);
+	printf("  - rebuilding v2 instead: %'lu usec\n", rebuild_usec);
+	printf("  - %'lu missing\n", missing);
+}
+
+static struct hash_table_buffered *hash_table_buffered;
+
+void *run_buffered(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	struct hash_table_buffered_writer *writer =
+		hash_table_buffered_writer_create(hash_table_buffered);
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		char *string = get_string(global_index);
+		hash_table_buffered_writer_add(writer, string, global_index);
+	}
+	hash_table_buffered_writer_destroy(writer);
+	return NULL;
+}
+
+/* End to end, the time only stops once everything is in the table. */
+static void run_buffered_v2(pthread_t *threads)
+{
+	hash_table_v2 = create_v2();
+	unsigned long direct_usec = run_threads(threads, arguments.threads, run_v2);
+	hash_table_v2_destroy(hash_table_v2);
+
+	hash_table_v2 = create_v2();
+	uint64_t start = bench_nsec_now();
+	hash_table_buffered = hash_table_buffered_create(hash_table_v2,
+	                                                 arguments.merge_threads);
+	unsigned long writers_usec = run_threads(threads, arguments.threads,
+	                                         run_buffered);
+	hash_table_buffered_flush(hash_table_buffered);
+	unsigned long usec = usec_since(start);
+	hash_table_buffered_destroy(hash_table_buffered);
+
+	uint64_t operations = (uint64_t) arguments.threads * arguments.size;
+	printf("Hash table v2 buffered (%'u merge threads): %'lu usec\n",
+	       arguments.merge_threads, usec);
+	printf("  - writers done after %'lu usec\n", writers_usec);
+	printf("  - direct inserts: %'lu usec\n", direct_usec);
+	if (usec > 0 && direct_usec > 0) {
+		printf("  - %'lu inserts/sec buffered, %'lu inserts/sec direct\n",
+		       operations * 1000000 / usec, operations * 1000000 / direct_usec);
+	}
+
+	size_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			if (!hash_table_v2_contains(hash_table_v2, get_string(global_index))) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_v2_destroy(hash_table_v2);
+}
+
+/* Buckets are grouped by how many contended acquisitions they had, 0, 1,
+   2-3, 4-7 and so on. */
+#define CONTENTION_BINS 16
+
+static void run_lock_stats(pthread_t *threads)
+{
+	struct hash_table_v2_options options = { 0 };
+	options.hash = arguments.hash;
+	options.lock = HASH_TABLE_V2_LOCK_MUTEX;
+	hash_table_v2 = hash_table_v2_create_with_options(&options);
+	unsigned long mutex_usec = run_threads(threads, arguments.threads, run_v2);
+	hash_table_v2_destroy(hash_table_v2);
+
+	options.lock = HASH_TABLE_V2_LOCK_ADAPTIVE;
+	hash_table_v2 = hash_table_v2_create_with_options(&options);
+	unsigned long adaptive_usec = run_threads(threads, arguments.threads, run_v2);
+
+	/* The clock reads would skew the time above, so hold times come from
+	   a run of their own */
+	options.lock_timing = true;
+	struct hash_table_v2 *timed = hash_table_v2_create_with_options(&options);
+	struct hash_table_v2 *untimed = hash_table_v2;
+	hash_table_v2 = timed;
+	run_threads(threads, arguments.threads, run_v2);
+
+	struct bucket_lock_stats total = { 0 };
+	uint64_t hold_nsec = 0;
+	size_t bins[CONTENTION_BINS] = { 0 };
+	for (size_t i = 0; i < HASH_TABLE_CAPACITY; ++i) {
+		struct bucket_lock_stats stats;
+		hash_table_v2_lock_stats(untimed, i, &stats);
+		total.acquisitions += stats.acquisitions;
+		total.contended += stats.contended;
+		total.spins += stats.spins;
+		total.parks += stats.parks;
+		size_t bin = 0;
+		for (uint64_t contended = stats.contended; contended > 0; contended /= 2) {
+			++bin;
+		}
+		++bins[bin < CONTENTION_BINS ? bin : CONTENTION_BINS - 1];
+
+		hash_table_v2_lock_stats(timed, i, &stats);
+		hold_nsec += stats.hold_nsec;
+	}
+	hash_table_v2_destroy(timed);
+	hash_table_v2_destroy(untimed);
+
+	printf("Hash table v2 adaptive locks: %'lu usec (mutex %'lu usec)\n",
+	       adaptive_usec, mutex_usec);
+	printf("  - %'lu acquisitions, %'lu contended, %'lu spins, %'lu parks\n",
+	       total.acquisitions, total.contended, total.spins, total.parks);
+	if (total.acquisitions > 0) {
+		printf("  - %.2f%% contended, %.1f nsec average hold\n",
+		       100.0 * total.contended / total.acquisitions,
+		       (double) hold_nsec / total.acquisitions);
+	}
+	printf("  - buckets by contended acquisitions:\n");
+	size_t last = 0;
+	for (size_t i = 0; i < CONTENTION_BINS; ++i) {
+		if (bins[i] > 0) {
+			last = i;
+		}
+	}
+	for (size_t i = 0; i <= last; ++i) {
+		if (i <= 1) {
+			printf("    %12lu: %'lu\n", i, bins[i]);
+		}
+		else if (i == CONTENTION_BINS - 1) {
+			printf("    %10lu- : %'lu\n", 1UL << (i - 1), bins[i]);
+		}
+		else {
+			char range[48];
+			snprintf(range, sizeof(range), "%lu-%lu", 1UL << (i - 1), (1UL << i) - 1);
+			printf("    %12s: %'lu\n", range, bins[i]);
+		}
+	}
+}
+
+static uint64_t *lookup_nsec;
+
+/* Every lookup is timed on its own, so the clock reads are part of each
+   sample. They cost the same for both tables, and it's the tail we're
+   after. */
+void *run_v2_lookup_timed(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		uint64_t start = bench_nsec_now();
+		hash_table_v2_contains(hash_table_v2, get_string(global_index));
+		lookup_nsec[global_index] = bench_nsec_now() - start;
+	}
+	return NULL;
+}
+
+void *run_cuckoo_lookup_timed(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		uint64_t start = bench_nsec_now();
+		hash_table_cuckoo_contains(hash_table_cuckoo, get_string(global_index));
+		lookup_nsec[global_index] = bench_nsec_now() - start;
+	}
+	return NULL;
+}
+
+static void print_latency(const char *name, size_t count)
+{
+	uint64_t p50 = bench_percentile(lookup_nsec, count, 50);
+	uint64_t p99 = bench_percentile(lookup_nsec, count, 99);
+	uint64_t p999 = bench_percentile(lookup_nsec, count, 99.9);
+	uint64_t max = bench_percentile(lookup_nsec, count, 100);
+	printf("  %s: p50 %'lu, p99 %'lu, p99.9 %'lu, max %'lu\n",
+	       name, p50, p99, p999, max);
+}
+
+/* With writers running, the first half of every thread's keys is added
+   beforehand. Readers look up that half while as many writers add the
+   other half, all of them start together. */
+static bool latency_cuckoo;
+static pthread_barrier_t latency_start;
+
+static void latency_add(uint32_t thread, uint32_t index)
+{
+	size_t global_index = get_global_index(thread, index);
+	char *string = get_string(global_index);
+	if (latency_cuckoo) {
+		hash_table_cuckoo_add_entry(hash_table_cuckoo, string, global_index);
+	} else {
+		hash_table_v2_add_entry(hash_table_v2, string, global_index);
+	}
+}
+
+void *run_latency_preload(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size / 2; ++j) {
+		latency_add(thread, j);
+	}
+	return NULL;
+}
+
+void *run_latency_with_writers(void *arg) {
+	uint32_t index = (uintptr_t) arg;
+	pthread_barrier_wait(&latency_start);
+	if (index >= arguments.threads) {
+		for (uint32_t j = arguments.size / 2; j < arguments.size; ++j) {
+			latency_add(index - arguments.threads, j);
+		}
+		return NULL;
+	}
+	uint32_t half = arguments.size / 2;
+	for (uint32_t j = 0; j < half; ++j) {
+		char *string = get_string(get_global_index(index, j));
+		uint64_t start = bench_nsec_now();
+		if (latency_cuckoo) {
+			hash_table_cuckoo_contains(hash_table_cuckoo, string);
+		} else {
+			hash_table_v2_contains(hash_table_v2, string);
+		}
+		lookup_nsec[(size_t) index * half + j] = bench_nsec_now() - start;
+	}
+	return NULL;
+}
+
+static void run_latency_writers(void)
+{
+	uint32_t count = arguments.threads * 2;
+	size_t lookups = (size_t) arguments.threads * (arguments.size / 2);
+	if (lookups == 0) {
+		return;
+	}
+	pthread_t *threads = calloc(count, sizeof(pthread_t));
+	assert(threads != NULL);
+	printf("Lookup latency with %u writers (%'lu lookups, nsec):\n",
+	       arguments.threads, lookups);
+
+	pthread_barrier_init(&latency_start, NULL, count);
+	latency_cuckoo = false;
+	hash_table_v2 = create_v2();
+	run_threads(threads, arguments.threads, run_latency_preload);
+	run_threads(threads, count, run_latency_with_writers);
+	hash_table_v2_destroy(hash_table_v2);
+	print_latency("v2", lookups);
+
+	latency_cuckoo = true;
+	hash_table_cuckoo = hash_table_cuckoo_create();
+	run_threads(threads, arguments.threads, run_latency_preload);
+	run_threads(threads, count, run_latency_with_writers);
+	hash_table_cuckoo_destroy(hash_table_cuckoo);
+	print_latency("cuckoo", lookups);
+	pthread_barrier_destroy(&latency_start);
+
+	free(threads);
+}
+
+/* A chain in v2 can get arbitrarily long, a lookup in the cuckoo table
+   reads two buckets at most. The cuckoo readers retry while a writer holds
+   one of their stripes, so we also time them with writers running. */
+static void run_latency(pthread_t *threads)
+{
+	size_t count = (size_t) arguments.threads * arguments.size;
+	lookup_nsec = calloc(count > 0 ? count : 1, sizeof(uint64_t));
+	printf("Lookup latency (%'lu lookups, nsec):\n", count);
+
+	hash_table_v2 = create_v2();
+	run_threads(threads, arguments.threads, run_v2);
+	run_threads(threads, arguments.threads, run_v2_lookup_timed);
+	hash_table_v2_destroy(hash_table_v2);
+	print_latency("v2", count);
+
+	hash_table_cuckoo = hash_table_cuckoo_create();
+	run_threads(threads, arguments.threads, run_cuckoo);
+	run_threads(threads, arguments.threads, run_cuckoo_lookup_timed);
+	hash_table_cuckoo_destroy(hash_table_cuckoo);
+	print_latency("cuckoo", count);
+
+	run_latency_writers();
+	free(lookup_nsec);
+}
+
+static struct hash_table_u64 *hash_table_u64;
+static struct hash_table_key16 *hash_table_key16;
+
+/* FNV-1a, started from `basis` so two different ones give two independent
+   halves of a 16 byte key. */
+static uint64_t fnv1a_64(const char *string, uint64_t basis)
+{
+	uint64_t hash = basis;
+	for (const unsigned char *c = (const unsigned char *) string; *c != '\0'; ++c) {
+		hash = (hash ^ *c) * 0x100000001b3;
+	}
+	return hash;
+}
+
+/* The integer keys are just the key numbers. A string of up to 16 bytes is
+   its own 16 byte key padded with zeros, a longer one is folded into two
+   64 bit hashes of all of it, so both tables get as many distinct keys as
+   the string tables. */
+static struct key16 get_key16(size_t global_index)
+{
+	struct key16 key = { 0 };
+	const char *string = get_string(global_index);
+	size_t length = strnlen(string, sizeof(key.bytes) + 1);
+	if (length <= sizeof(key.bytes)) {
+		memcpy(key.bytes, string, length);
+		return key;
+	}
+	uint64_t halves[2] = {
+		fnv1a_64(string, 0xcbf29ce484222325),
+		fnv1a_64(string, 0x84222325cbf29ce4),
+	};
+	memcpy(key.bytes, halves, sizeof(halves));
+	return key;
+}
+
+void *run_u64(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		hash_table_u64_add_entry(hash_table_u64, global_index, global_index);
+	}
+	return NULL;
+}
+
+void *run_u64_lookup(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		if (!hash_table_u64_contains(hash_table_u64, global_index)) {
+			++missing;
+		}
+	}
+	batch_missing[thread] = missing;
+	return NULL;
+}
+
+void *run_key16(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		hash_table_key16_add_entry(hash_table_key16, get_key16(global_index),
+		                           global_index);
+	}
+	return NULL;
+}
+
+void *run_key16_lookup(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	uint64_t missing = 0;
+	for (uint32_t j = 0; j < arguments.size; ++j) {
+		size_t global_index = get_global_index(thread, j);
+		if (!hash_table_key16_contains(hash_table_key16, get_key16(global_index))) {
+			++missing;
+		}
+	}
+	batch_missing[thread] = missing;
+	return NULL;
+}
+
+static uint64_t sum_missing(void)
+{
+	uint64_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		missing += batch_missing[i];
+	}
+	return missing;
+}
+
+/* `run_v2_lookup` counts what it didn't find in `batch_missing`, so the
+   other tables do too. */
+/* Strings that turn into the same 16 byte key overwrite each other's
+   values, so every key should still have its own. */
+static size_t count_key16_collisions(void)
+{
+	size_t count = (size_t) arguments.threads * arguments.size;
+	size_t collisions = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (hash_table_key16_get_value(hash_table_key16, get_key16(i)) != i) {
+			++collisions;
+		}
+	}
+	return collisions;
+}
+
+static void run_int_keys(pthread_t *threads)
+{
+	batch_missing = calloc(arguments.threads, sizeof(uint64_t));
+
+	hash_table_v2 = create_v2();
+	unsigned long insert_usec = run_threads(threads, arguments.threads, run_v2);
+	unsigned long lookup_usec = run_threads(threads, arguments.threads,
+	                                        run_v2_lookup);
+	hash_table_v2_destroy(hash_table_v2);
+	printf("Hash table v2: %'lu usec inserting, %'lu usec looking up\n",
+	       insert_usec, lookup_usec);
+	printf("  - %'lu missing\n", sum_missing());
+
+	hash_table_u64 = hash_table_u64_create();
+	insert_usec = run_threads(threads, arguments.threads, run_u64);
+	lookup_usec = run_threads(threads, arguments.threads, run_u64_lookup);
+	hash_table_u64_destroy(hash_table_u64);
+	printf("Hash table u64: %'lu usec inserting, %'lu usec looking up\n",
+	       insert_usec, lookup_usec);
+	printf("  - %'lu missing\n", sum_missing());
+
+	hash_table_key16 = hash_table_key16_create();
+	insert_usec = run_threads(threads, arguments.threads, run_key16);
+	lookup_usec = run_threads(threads, arguments.threads, run_key16_lookup);
+	size_t collisions = count_key16_collisions();
+	hash_table_key16_destroy(hash_table_key16);
+	printf("Hash table key16: %'lu usec inserting, %'lu usec looking up\n",
+	       insert_usec, lookup_usec);
+	printf("  - %'lu missing\n", sum_missing());
+	printf("  - %'lu collided\n", collisions);
+
+	free(batch_missing);
+}
+
+/* Many small tables pay mostly for what an empty one takes, a big one for
+   what every key takes. */
+static void run_memory(pthread_t *threads)
+{
+	printf("Memory (%'lu keys):\n", (size_t) arguments.threads * arguments.size);
+	for (size_t i = 0; i < TABLES_COUNT; ++i) {
+		const struct table_ops *ops = &tables[i];
+		struct hash_table_memory_usage usage;
+		table = ops->create();
+		ops->memory_usage(table, &usage);
+		size_t empty = hash_table_memory_usage_total(&usage);
+		add_entry = ops->add_entry;
+		run_threads(threads, arguments.threads, run_add_entry);
+		ops->memory_usage(table, &usage);
+		ops->destroy(table);
+
+		size_t total = hash_table_memory_usage_total(&usage);
+		printf("  %s: %'lu bytes empty, %'lu bytes full", ops->name, empty, total);
+		if (usage.keys > 0) {
+			printf(", %.1f bytes/key", (double) total / usage.keys);
+		}
+		printf("\n");
+		printf("    - table %'lu, buckets %'lu, locks %'lu, entries %'lu, "
+		       "keys %'lu\n", usage.table_bytes, usage.bucket_bytes,
+		       usage.lock_bytes, usage.entry_bytes, usage.key_bytes);
+	}
+}
+
+/* The bulk build starts its own threads, and its time includes
+   partitioning the keys. */
+static void run_bulk(pthread_t *threads)
+{
+	size_t count = (size_t) arguments.threads * arguments.size;
+	const char **keys = malloc((count > 0 ? count : 1) * sizeof(char *));
+	uint32_t *values = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+	assert(keys != NULL && values != NULL);
+	for (size_t i = 0; i < count; ++i) {
+		keys[i] = get_string(i);
+		values[i] = i;
+	}
+
+	hash_table_v2 = create_v2();
+	unsigned long locked_usec = run_threads(threads, arguments.threads, run_v2);
+	hash_table_v2_destroy(hash_table_v2);
+
+	hash_table_v2 = create_v2();
+	uint64_t start = bench_nsec_now();
+	hash_table_v2_bulk_build(hash_table_v2, keys, values, count, arguments.threads);
+	unsigned long bulk_usec = usec_since(start);
+
+	size_t missing = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (!hash_table_v2_contains(hash_table_v2, keys[i])) {
+			++missing;
+		}
+	}
+	hash_table_v2_destroy(hash_table_v2);
+
+	printf("Hash table v2 bulk build: %'lu usec (locked %'lu usec", bulk_usec,
+	       locked_usec);
+	if (bulk_usec > 0) {
+		printf(", %.2fx", (double) locked_usec / bulk_usec);
+	}
+	printf(")\n");
+	printf("  - %'lu missing\n", missing);
+	free(keys);
+	free(values);
+}
+
+static struct perf_counters *thread_counters;
+
+/* Counts only the thread's own inserts, not creating or joining it. */
+void *run_add_entry_counted(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	perf_counters_start(&thread_counters[thread]);
+	run_add_entry(arg);
+	perf_counters_stop(&thread_counters[thread]);
+	return NULL;
+}
+
+static void run_perf(pthread_t *threads)
+{
+	thread_counters = calloc(arguments.threads, sizeof(struct perf_counters));
+	uint64_t operations = (uint64_t) arguments.threads * arguments.size;
+	printf("Perf counters (%'u threads, per insert except context "
+	       "switches):\n", arguments.threads);
+	for (size_t i = 0; i < TABLES_COUNT; ++i) {
+		const struct table_ops *ops = &tables[i];
+		table = ops->create();
+		add_entry = ops->add_entry;
+		run_threads(threads, arguments.threads, run_add_entry_counted);
+		ops->destroy(table);
+
+		/* A counter only counts if every thread got it */
+		uint64_t totals[PERF_COUNTER_COUNT] = { 0 };
+		bool available[PERF_COUNTER_COUNT];
+		for (size_t k = 0; k < PERF_COUNTER_COUNT; ++k) {
+			available[k] = true;
+			for (uint32_t j = 0; j < arguments.threads; ++j) {
+				available[k] &= thread_counters[j].available[k];
+				totals[k] += thread_counters[j].values[k];
+			}
+		}
+
+		printf("  %s:", ops->name);
+		for (size_t k = 0; k < PERF_COUNTER_COUNT; ++k) {
+			const char *name = perf_counter_name(k);
+			if (!available[k]) {
+				printf("%s %s n/a", k == 0 ? "" : ",", name);
+			}
+			else if (k == PERF_COUNTER_CONTEXT_SWITCHES) {
+				printf("%s %s %'lu", k == 0 ? "" : ",", name, totals[k]);
+			}
+			else if (operations > 0) {
+				printf("%s %s %.2f", k == 0 ? "" : ",", name,
+				       (double) totals[k] / operations);
+			}
+		}
+		if (available[PERF_COUNTER_CYCLES] && available[PERF_COUNTER_INSTRUCTIONS]
+		    && totals[PERF_COUNTER_CYCLES] > 0) {
+			printf(", IPC %.2f", (double) totals[PERF_COUNTER_INSTRUCTIONS]
+			                     / totals[PERF_COUNTER_CYCLES]);
+		}
+		printf("\n");
+	}
+	free(thread_counters);
+}
+
+/* Times the inserts of every table from a new, empty table each time. The
+   warmup runs fault in the memory and warm up the caches and the allocator,
+   so the timed runs don't depend on which table happened to go first. */
+static void run_bench(pthread_t *threads)
+{
+	uint64_t *samples = calloc(arguments.repeat, sizeof(uint64_t));
+	struct bench_result results[TABLES_COUNT];
+	for (size_t i = 0; i < TABLES_COUNT; ++i) {
+		const struct table_ops *ops = &tables[i];
+		add_entry = ops->add_entry;
+		for (uint32_t j = 0; j < arguments.warmup + arguments.repeat; ++j) {
+			table = ops->create();
+			uint64_t nsec = run_threads_nsec(threads, arguments.threads,
+			                                 run_add_entry);
+			ops->destroy(table);
+			if (j >= arguments.warmup) {
+				samples[j - arguments.warmup] = nsec;
+			}
+		}
+
+		struct bench_result *result = &results[i];
+		result->name = ops->name;
+		result->threads = arguments.threads;
+		result->size = arguments.size;
+		bench_result_compute(result, samples, arguments.repeat,
+		                     (uint64_t) arguments.threads * arguments.size);
+	}
+	free(samples);
+	bench_print(stdout, arguments.format, results, TABLES_COUNT);
+}
+
+static void print_generation(unsigned long usec)
+{
+	if (arguments.workload_name != NULL || arguments.overlap > 0) {
+		printf("Generation (%s, %'u letters, %'u%% overlap): %'lu usec\n",
+		       workload_kind_name(arguments.workload), arguments.key_length,
+		       arguments.overlap, usec);
+	}
+	else {
+		printf("Generation: %'lu usec\n", usec);
+	}
+}
+
+/* Each thread generates its own keys. We map `data` without touching it, so
+   the pages of a thread's keys get allocated on the NUMA node of the thread
+   that writes them first. With `--pin` that's the same CPU the thread with
+   the same number inserts them from later. Only the pages a neighbouring
+   thread's keys share may land elsewhere. */
+void *run_generate(void *arg) {
+	uint32_t thread = (uintptr_t) arg;
+	workload_fill(&workload, thread, get_string(get_global_index(thread, 0)));
+	return NULL;
+}
+
+static void generate(pthread_t *threads)
+{
+	workload_init(&workload, arguments.workload, arguments.key_length,
+	              arguments.overlap, arguments.threads, arguments.size);
+	bytes_per_string = workload_stride(&workload);
+	data_bytes = (size_t) arguments.threads * arguments.size * bytes_per_string;
+	/* `mmap` doesn't take 0 bytes */
+	if (data_bytes == 0) {
+		data_bytes = 1;
+	}
+	data = mmap(NULL, data_bytes, PROT_READ | PROT_WRITE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	run_threads(threads, arguments.threads, run_generate);
+}
+
+int main(int argc, char *argv[]) {
+	arguments.threads = 4;
+	arguments.size = 25000;
+	arguments.repeat = 5;
+	arguments.warmup = 1;
+	arguments.key_length = 7;
+  
+	// static struct argp argp = { options, parse_opt };
+	static struct argp argp = { 0 };
+	argp.options = options;
+	argp.parser = parse_opt;
+	argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+	setlocale(LC_ALL, "en_US.UTF-8");
+
+	if (arguments.pin) {
+		find_cpus();
+	}
+
+	pthread_t *threads = calloc(arguments.threads, sizeof(pthread_t));
+
+	uint64_t start = bench_nsec_now();
+	generate(threads);
+	unsigned long generation_usec = usec_since(start);
+
+	/* CSV and JSON output has to be the only thing we print */
+	if (arguments.bench) {
+		if (arguments.format == BENCH_FORMAT_TEXT) {
+			print_generation(generation_usec);
+		}
+		run_bench(threads);
+		free(threads);
+		free(cpus);
+		munmap(data, data_bytes);
+		return 0;
+	}
+
+	print_generation(generation_usec);
+
+	struct hash_table_base *hash_table_base = hash_table_base_create();
+	start = bench_nsec_now();
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			hash_table_base_add_entry(hash_table_base, string, global_index);
+		}
+	}
+	printf("Hash table base: %'lu usec\n", usec_since(start));
+
+	size_t missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_base_contains(hash_table_base, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_base_destroy(hash_table_base);
+
+	hash_table_v1 = hash_table_v1_create();
+	printf("Hash table v1: %'lu usec\n",
+	       run_threads(threads, arguments.threads, run_v1));
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_v1_contains(hash_table_v1, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_v1_destroy(hash_table_v1);
+
+	hash_table_v2 = create_v2();
+	unsigned long usec = run_threads(threads, arguments.threads, run_v2);
+	if (arguments.hash_name != NULL) {
+		printf("Hash table v2 (%s): %'lu usec\n", arguments.hash_name, usec);
+	}
+	else {
+		printf("Hash table v2: %'lu usec\n", usec);
+	}
+	if (arguments.alloc_stats) {
+		run_alloc_stats(threads, usec);
+	}
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_v2_contains(hash_table_v2, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_v2_destroy(hash_table_v2);
+
+	hash_table_v3 = hash_table_v3_create();
+	printf("Hash table v3: %'lu usec\n",
+	       run_threads(threads, arguments.threads, run_v3));
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_v3_contains(hash_table_v3, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_v3_destroy(hash_table_v3);
+
+	hash_table_lockfree = hash_table_lockfree_create();
+	printf("Hash table lock-free: %'lu usec\n",
+	       run_threads(threads, arguments.threads, run_lockfree));
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_lockfree_contains(hash_table_lockfree, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_lockfree_destroy(hash_table_lockfree);
+
+	hash_table_resizable = hash_table_resizable_create();
+	worst_insert_nsec = calloc(arguments.threads, sizeof(uint64_t));
+	printf("Hash table resizable: %'lu usec\n",
+	       run_threads(threads, arguments.threads, run_resizable));
+
+	uint64_t worst = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		if (worst_insert_nsec[i] > worst) {
+			worst = worst_insert_nsec[i];
+		}
+	}
+	free(worst_insert_nsec);
+	printf("  - %'u resizes\n",
+	       hash_table_resizable_resize_count(hash_table_resizable));
+	printf("  - %'lu nsec worst insert\n", worst);
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_resizable_contains(hash_table_resizable, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_resizable_destroy(hash_table_resizable);
+
+	hash_table_cuckoo = hash_table_cuckoo_create();
+	printf("Hash table cuckoo: %'lu usec\n",
+	       run_threads(threads, arguments.threads, run_cuckoo));
+	printf("  - %'u resizes\n",
+	       hash_table_cuckoo_resize_count(hash_table_cuckoo));
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_cuckoo_contains(hash_table_cuckoo, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_cuckoo_destroy(hash_table_cuckoo);
+
+	hash_table_compact = hash_table_compact_create();
+	printf("Hash table compact: %'lu usec\n",
+	       run_threads(threads, arguments.threads, run_compact));
+
+	missing = 0;
+	for (uint32_t i = 0; i < arguments.threads; ++i) {
+		for (uint32_t j = 0; j < arguments.size; ++j) {
+			size_t global_index = get_global_index(i, j);
+			char *string = get_string(global_index);
+			if (!hash_table_compact_contains(hash_table_compact, string)) {
+				++missing;
+			}
+		}
+	}
+	printf("  - %'lu missing\n", missing);
+	hash_table_compact_destroy(hash_table_compact);
+
+	if (arguments.batch > 0) {
+		run_batch(threads);
+	}
+
+	if (arguments.churn) {
+		run_churn(threads);
+	}
+
+	if (arguments.hash_stats) {
+		run_hash_stats();
+	}
+
+	if (arguments.mixed) {
+		run_mixed(threads);
+	}
+
+	if (arguments.scaling) {
+		run_scaling(threads);
+	}
+
+	if (arguments.stripes_sweep) {
+		run_stripes_sweep(threads);
+	}
+
+	if (arguments.perf) {
+		run_perf(threads);
+	}
+
+	if (arguments.snapshot != NULL) {
+		run_snapshot(threads);
+	}
+
+	if (arguments.mmap != NULL) {
+		run_mmap_table(threads);
+	}
+
+	if (arguments.buffered) {
+		run_buffered_v2(threads);
+	}
+
+	if (arguments.lock_stats) {
+		run_lock_stats(threads);
+	}
+
+	if (arguments.latency) {
+		run_latency(threads);
+	}
+
+	if (arguments.int_keys) {
+		run_int_keys(threads);
+	}
+
+	if (arguments.memory) {
+		run_memory(threads);
+	}
+
+	if (arguments.bulk) {
+		run_bulk(threads);
+	}
 
 	free(threads);
-	free(data);
+	free(cpus);
+	munmap(data, data_bytes);
 
 	return 0;
 }
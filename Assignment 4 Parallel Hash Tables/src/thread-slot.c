@@ -0,0 +1,151 @@
+#include "thread-slot.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static pthread_mutex_t slots_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Which of the `slot_count` numbers handed out so far are in use,
+   protected by `slots_mutex`. */
+static bool *slot_used;
+static size_t slot_capacity;
+static _Atomic size_t slot_count;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;
+
+/* Stored plus one, so 0 means we haven't picked a slot yet. */
+static _Thread_local size_t thread_slot;
+
+static void release_slot(void *value)
+{
+	size_t slot = (uintptr_t) value - 1;
+	pthread_mutex_lock(&slots_mutex);
+	slot_used[slot] = false;
+	pthread_mutex_unlock(&slots_mutex);
+}
+
+static void create_slot_key(void)
+{
+	int err = pthread_key_create(&slot_key, release_slot);
+	assert(err == 0);
+	(void) err;
+}
+
+/* The key's destructor gives the number back when the thread exits. */
+size_t thread_slot_get(void)
+{
+	if (thread_slot != 0) {
+		return thread_slot - 1;
+	}
+
+	pthread_once(&slot_key_once, create_slot_key);
+	pthread_mutex_lock(&slots_mutex);
+	size_t count = atomic_load_explicit(&slot_count, memory_order_relaxed);
+	size_t slot = 0;
+	while (slot < count && slot_used[slot]) {
+		++slot;
+	}
+	if (slot == count) {
+		if (count == slot_capacity) {
+			slot_capacity = slot_capacity == 0 ? 64 : slot_capacity * 2;
+			slot_used = realloc(slot_used, slot_capacity * sizeof(bool));
+			assert(slot_used != NULL);
+		}
+		atomic_store_explicit(&slot_count, count + 1, memory_order_release);
+	}
+	slot_used[slot] = true;
+	pthread_mutex_unlock(&slots_mutex);
+
+	thread_slot = slot + 1;
+	pthread_setspecific(slot_key, (void *) (uintptr_t) thread_slot);
+	return slot;
+}
+
+size_t thread_slot_count(void)
+{
+	return atomic_load_explicit(&slot_count, memory_order_acquire);
+}
+
+void thread_slot_array_init(struct thread_slot_array *array,
+                            size_t element_size,
+                            size_t alignment)
+{
+	assert(element_size % alignment == 0);
+	array->element_size = element_size;
+	array->alignment = alignment;
+	for (size_t i = 0; i < THREAD_SLOT_SEGMENTS; ++i) {
+		atomic_init(&array->segments[i], NULL);
+	}
+}
+
+/* Segment `i` holds `THREAD_SLOT_FIRST_SEGMENT << i` elements, the first
+   of them for slot `(THREAD_SLOT_FIRST_SEGMENT << i) - THREAD_SLOT_FIRST_SEGMENT`. */
+static size_t get_segment(size_t slot, size_t *index)
+{
+	size_t shifted = slot + THREAD_SLOT_FIRST_SEGMENT;
+	size_t segment = (sizeof(unsigned long long) * 8 - 1
+	                  - __builtin_clzll(shifted))
+	                 - __builtin_ctz(THREAD_SLOT_FIRST_SEGMENT);
+	assert(segment < THREAD_SLOT_SEGMENTS);
+	*index = shifted - ((size_t) THREAD_SLOT_FIRST_SEGMENT << segment);
+	return segment;
+}
+
+void *thread_slot_array_find(struct thread_slot_array *array, size_t slot)
+{
+	size_t index;
+	size_t segment = get_segment(slot, &index);
+	char *elements = atomic_load_explicit(&array->segments[segment],
+	                                      memory_order_acquire);
+	if (elements == NULL) {
+		return NULL;
+	}
+	return elements + index * array->element_size;
+}
+
+/* Threads in the same segment may race to allocate it, the loser frees its
+   copy. */
+void *thread_slot_array_get(struct thread_slot_array *array, size_t slot)
+{
+	size_t index;
+	size_t segment = get_segment(slot, &index);
+	char *elements = atomic_load_explicit(&array->segments[segment],
+	                                      memory_order_acquire);
+	if (elements == NULL) {
+		size_t bytes = ((size_t) THREAD_SLOT_FIRST_SEGMENT << segment)
+		               * array->element_size;
+		char *new_elements = aligned_alloc(array->alignment, bytes);
+		assert(new_elements != NULL);
+		memset(new_elements, 0, bytes);
+		if (atomic_compare_exchange_strong_explicit(&array->segments[segment],
+		                                            &elements, new_elements,
+		                                            memory_order_acq_rel,
+		                                            memory_order_acquire)) {
+			elements = new_elements;
+		} else {
+			free(new_elements);
+		}
+	}
+	return elements + index * array->element_size;
+}
+
+size_t thread_slot_array_bytes(struct thread_slot_array *array)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < THREAD_SLOT_SEGMENTS; ++i) {
+		if (atomic_load_explicit(&array->segments[i], memory_order_relaxed) != NULL) {
+			bytes += ((size_t) THREAD_SLOT_FIRST_SEGMENT << i) * array->element_size;
+		}
+	}
+	return bytes;
+}
+
+void thread_slot_array_destroy(struct thread_slot_array *array)
+{
+	for (size_t i = 0; i < THREAD_SLOT_SEGMENTS; ++i) {
+		free(atomic_load_explicit(&array->segments[i], memory_order_relaxed));
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* A `thread_slot_array` is split in segments, the first one holds
+   `THREAD_SLOT_FIRST_SEGMENT` elements and every next one twice as many as
+   the one before. That's more slots than there can ever be threads. */
+#define THREAD_SLOT_FIRST_SEGMENT 8
+#define THREAD_SLOT_SEGMENTS 32
+
+/* Returns a small number for the calling thread, so per-thread state can be
+   kept in arrays. A thread gets the lowest free number the first time it
+   asks, and gives it back when it exits. */
+size_t thread_slot_get(void);
+/* Every number below this one is or was handed out. */
+size_t thread_slot_count(void);
+
+/* Per-thread state indexed by `thread_slot_get`. A segment is only
+   allocated once a thread with a number in it asks for its element, so a
+   structure only pays for the threads that actually used it. Elements
+   start out zeroed and never move. */
+struct thread_slot_array {
+	size_t element_size;
+	size_t alignment;
+	_Atomic(char *) segments[THREAD_SLOT_SEGMENTS];
+};
+
+/* `element_size` has to be a multiple of `alignment`. */
+void thread_slot_array_init(struct thread_slot_array *array,
+                            size_t element_size,
+                            size_t alignment);
+/* Returns the element of `slot`, allocating it if needed. */
+void *thread_slot_array_get(struct thread_slot_array *array, size_t slot);
+/* Returns the element of `slot`, or `NULL` if nobody allocated it yet. */
+void *thread_slot_array_find(struct thread_slot_array *array, size_t slot);
+/* Returns how many bytes of elements have been allocated. */
+size_t thread_slot_array_bytes(struct thread_slot_array *array);
+void thread_slot_array_destroy(struct thread_slot_array *array);
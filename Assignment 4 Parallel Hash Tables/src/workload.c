@@ -0,0 +1,236 @@
+#include "workload.h"
+
+#include "hash-table-common.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+/* The skew YCSB uses by default. */
+#define ZIPF_THETA 0.99
+
+/* Adversarial keys all hash to one of this many buckets. */
+#define ADVERSARIAL_BUCKETS 16
+
+/* With 16 of 4096 buckets, 1 letter never reaches one of them and 2 letters
+   reach them with only about 10 keys. 4 letters give about 28,000. */
+#define ADVERSARIAL_MIN_KEY_LENGTH 4
+
+/* How many letters of a prefix workload key are the counter at least, the
+   rest is the prefix. */
+#define PREFIX_COUNTER_LENGTH 4
+
+static const char *const workload_names[] = {
+	[WORKLOAD_UNIFORM] = "uniform",
+	[WORKLOAD_ZIPF] = "zipf",
+	[WORKLOAD_SEQUENTIAL] = "sequential",
+	[WORKLOAD_PREFIX] = "prefix",
+	[WORKLOAD_ADVERSARIAL] = "adversarial",
+};
+
+#define WORKLOAD_COUNT (sizeof(workload_names) / sizeof(workload_names[0]))
+
+bool workload_kind_parse(const char *name, enum workload_kind *kind)
+{
+	for (size_t i = 0; i < WORKLOAD_COUNT; ++i) {
+		if (strcmp(name, workload_names[i]) == 0) {
+			*kind = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *workload_kind_name(enum workload_kind kind)
+{
+	return workload_names[kind];
+}
+
+uint32_t workload_min_key_length(enum workload_kind kind)
+{
+	return kind == WORKLOAD_ADVERSARIAL ? ADVERSARIAL_MIN_KEY_LENGTH : 1;
+}
+
+/* splitmix64, to turn a thread number or a key number into a well mixed
+   seed. */
+static uint64_t mix(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/* Seeds for `next_random`, whose state must never be 0. */
+static uint64_t seed(uint64_t x)
+{
+	uint64_t state = mix(x);
+	return state != 0 ? state : 1;
+}
+
+/* xorshift64*, the same generator pht-tester uses. */
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* A double in [0, 1) from the top 53 bits. */
+static double next_double(uint64_t *state)
+{
+	return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double zeta(uint64_t n, double theta)
+{
+	double sum = 0;
+	for (uint64_t i = 1; i <= n; ++i) {
+		sum += 1 / pow(i, theta);
+	}
+	return sum;
+}
+
+static void zipf_init(struct zipf *zipf, uint64_t n, double theta)
+{
+	zipf->n = n;
+	zipf->theta = theta;
+	zipf->alpha = 1 / (1 - theta);
+	zipf->zetan = zeta(n, theta);
+	double zeta2 = zeta(2, theta);
+	zipf->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf->zetan);
+}
+
+static uint64_t zipf_next(const struct zipf *zipf, uint64_t *state)
+{
+	double u = next_double(state);
+	double uz = u * zipf->zetan;
+	if (uz < 1) {
+		return 0;
+	}
+	if (zipf->n > 1 && uz < 1 + pow(0.5, zipf->theta)) {
+		return 1;
+	}
+	uint64_t rank = zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha);
+	return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+void workload_init(struct workload *workload,
+                   enum workload_kind kind,
+                   uint32_t key_length,
+                   uint32_t overlap,
+                   uint32_t threads,
+                   uint32_t size)
+{
+	assert(key_length >= workload_min_key_length(kind));
+	assert(overlap <= 100);
+	workload->kind = kind;
+	workload->key_length = key_length;
+	workload->overlap = overlap;
+	workload->threads = threads;
+	workload->size = size;
+	memset(&workload->own, 0, sizeof(struct zipf));
+	memset(&workload->all, 0, sizeof(struct zipf));
+	if (kind == WORKLOAD_ZIPF && size > 0) {
+		zipf_init(&workload->own, size, ZIPF_THETA);
+		if (overlap > 0) {
+			zipf_init(&workload->all, (uint64_t) threads * size, ZIPF_THETA);
+		}
+	}
+}
+
+size_t workload_stride(const struct workload *workload)
+{
+	return workload->key_length + 1;
+}
+
+static char letter(uint64_t r)
+{
+	r %= 52;
+	return r < 26 ? 'A' + r : 'a' + (r - 26);
+}
+
+static void random_letters(char *key, uint32_t length, uint64_t *state)
+{
+	for (uint32_t i = 0; i < length; ++i) {
+		key[i] = letter(next_random(state) >> 32);
+	}
+}
+
+/* Writes `number` in base 52, most significant letter first. If it doesn't
+   fit, only the low letters are kept. */
+static void counter_letters(char *key, uint32_t length, uint64_t number)
+{
+	for (uint32_t i = length; i > 0; --i) {
+		key[i - 1] = letter(number);
+		number /= 52;
+	}
+}
+
+/* Every key is a function of its number, the same number always gives the
+   same key no matter which thread picked it. */
+static void format_key(const struct workload *workload, uint64_t number, char *key)
+{
+	uint32_t length = workload->key_length;
+	uint64_t state = seed(number);
+	switch (workload->kind) {
+	case WORKLOAD_UNIFORM:
+	case WORKLOAD_ZIPF:
+		random_letters(key, length, &state);
+		break;
+	case WORKLOAD_SEQUENTIAL:
+		counter_letters(key, length, number);
+		break;
+	case WORKLOAD_PREFIX: {
+		uint32_t counter = 1;
+		uint64_t keys = (uint64_t) workload->threads * workload->size;
+		for (uint64_t limit = 52; limit < keys; limit *= 52) {
+			++counter;
+		}
+		if (counter < PREFIX_COUNTER_LENGTH) {
+			counter = PREFIX_COUNTER_LENGTH;
+		}
+		if (counter > length) {
+			counter = length;
+		}
+		memset(key, 'P', length - counter);
+		counter_letters(key + length - counter, counter, number);
+		break;
+	}
+	case WORKLOAD_ADVERSARIAL:
+		/* About HASH_TABLE_CAPACITY / ADVERSARIAL_BUCKETS tries per key */
+		do {
+			random_letters(key, length, &state);
+			key[length] = 0;
+		} while (bernstein_hash(key) % HASH_TABLE_CAPACITY >= ADVERSARIAL_BUCKETS);
+		break;
+	}
+	key[length] = 0;
+}
+
+/* Without overlap a thread's key `j` is key number `thread * size + j`.
+   Otherwise `overlap` percent of them are picked at random from all the key
+   numbers. Zipf workloads pick every key by rank instead. */
+void workload_fill(const struct workload *workload, uint32_t thread, char *keys)
+{
+	uint64_t state = seed(~(uint64_t) thread);
+	uint64_t first = (uint64_t) thread * workload->size;
+	uint64_t all = (uint64_t) workload->threads * workload->size;
+	size_t stride = workload_stride(workload);
+	for (uint32_t j = 0; j < workload->size; ++j) {
+		bool shared = workload->overlap > 0
+		              && next_random(&state) % 100 < workload->overlap;
+		uint64_t number;
+		if (workload->kind == WORKLOAD_ZIPF) {
+			number = shared ? zipf_next(&workload->all, &state)
+			                : first + zipf_next(&workload->own, &state);
+		}
+		else {
+			number = shared ? next_random(&state) % all : first + j;
+		}
+		format_key(workload, number, keys + j * stride);
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum workload_kind {
+	/* Random letters, every key appears once (unless `overlap` says
+	   otherwise). */
+	WORKLOAD_UNIFORM,
+	/* Keys are picked with a Zipfian skew, a few hot keys get most of the
+	   operations. */
+	WORKLOAD_ZIPF,
+	/* The keys count up in base 52, so neighbouring keys differ only in
+	   their last letters. */
+	WORKLOAD_SEQUENTIAL,
+	/* Every key is the same long prefix followed by a short counter. */
+	WORKLOAD_PREFIX,
+	/* Random keys picked so the bernstein hash sends them all to a handful
+	   of buckets, which makes for very long chains. */
+	WORKLOAD_ADVERSARIAL,
+};
+
+/* Picks a key with rank `0` to `n - 1`, rank 0 being the most popular. This
+   is the method YCSB uses (Gray et al., "Quickly generating billion-record
+   synthetic databases"), with everything that depends only on `n`
+   computed up front. */
+struct zipf {
+	uint64_t n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+};
+
+/* Describes the keys for `threads` threads with `size` keys each. Every
+   thread's keys are generated from a random state of its own, so the keys
+   don't depend on the order the threads fill them in. */
+struct workload {
+	enum workload_kind kind;
+	/* Letters per key, not counting the NUL. */
+	uint32_t key_length;
+	/* The percentage of a thread's keys picked from every thread's keys
+	   rather than its own, those keys end up being inserted by several
+	   threads. */
+	uint32_t overlap;
+	uint32_t threads;
+	uint32_t size;
+	/* Only used by WORKLOAD_ZIPF, over one thread's keys and over all of
+	   them. */
+	struct zipf own;
+	struct zipf all;
+};
+
+/* Returns false if there's no workload called `name`. */
+bool workload_kind_parse(const char *name, enum workload_kind *kind);
+const char *workload_kind_name(enum workload_kind kind);
+/* The shortest keys the workload can make enough different ones of,
+   adversarial keys need a few letters to be able to hit their buckets. */
+uint32_t workload_min_key_length(enum workload_kind kind);
+
+void workload_init(struct workload *workload,
+                   enum workload_kind kind,
+                   uint32_t key_length,
+                   uint32_t overlap,
+                   uint32_t threads,
+                   uint32_t size);
+
+/* The bytes between the starts of two keys. */
+size_t workload_stride(const struct workload *workload);
+
+/* Writes the `size` keys of `thread`, each NUL-terminated, to `keys`, one
+   every `workload_stride` bytes. */
+void workload_fill(const struct workload *workload, uint32_t thread, char *keys);
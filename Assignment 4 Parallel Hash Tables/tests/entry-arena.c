@@ -0,0 +1,94 @@
+#include "entry-arena.h"
+#include "hash-table-common.h"
+#include "hash-table-v2.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TABLES 8
+#define KEYS 1000
+#define OBJECTS 2000
+
+static struct entry_arena shared_arena;
+static void *objects[OBJECTS];
+
+static void *free_objects(void *arg)
+{
+	(void) arg;
+	for (size_t i = 0; i < OBJECTS; ++i) {
+		entry_arena_free(&shared_arena, objects[i]);
+	}
+	return NULL;
+}
+
+/* Every table's entries fit in one slab, so switching between more tables
+   than a thread used to cache must not start new slabs. */
+int main(void)
+{
+	int failed = 0;
+
+	struct entry_arena arenas[TABLES];
+	for (size_t i = 0; i < TABLES; ++i) {
+		entry_arena_init(&arenas[i], 64);
+	}
+	for (size_t j = 0; j < KEYS; ++j) {
+		for (size_t i = 0; i < TABLES; ++i) {
+			entry_arena_alloc(&arenas[i]);
+		}
+	}
+	for (size_t i = 0; i < TABLES; ++i) {
+		size_t bytes = entry_arena_bytes(&arenas[i]);
+		if (bytes != 64 * 1024) {
+			fprintf(stderr, "arena %zu: %zu bytes of slabs, expected 65536\n",
+			        i, bytes);
+			failed = 1;
+		}
+		entry_arena_destroy(&arenas[i]);
+	}
+
+	struct hash_table_v2 *tables[TABLES];
+	for (size_t i = 0; i < TABLES; ++i) {
+		tables[i] = hash_table_v2_create();
+	}
+	char key[16];
+	for (size_t j = 0; j < KEYS; ++j) {
+		snprintf(key, sizeof(key), "key%zu", j);
+		for (size_t i = 0; i < TABLES; ++i) {
+			hash_table_v2_add_entry(tables[i], key, j);
+		}
+	}
+	for (size_t i = 0; i < TABLES; ++i) {
+		struct hash_table_memory_usage usage;
+		hash_table_v2_memory_usage(tables[i], &usage);
+		if (usage.entry_bytes > 64 * 1024) {
+			fprintf(stderr, "v2 table %zu: %zu entry bytes for %d keys\n",
+			        i, usage.entry_bytes, KEYS);
+			failed = 1;
+		}
+		hash_table_v2_destroy(tables[i]);
+	}
+
+	/* Objects freed by a thread that never allocates go back to the arena,
+	   all but the few that thread keeps for itself. */
+	entry_arena_init(&shared_arena, 64);
+	for (size_t i = 0; i < OBJECTS; ++i) {
+		objects[i] = entry_arena_alloc(&shared_arena);
+	}
+	size_t before = entry_arena_bytes(&shared_arena);
+	pthread_t thread;
+	pthread_create(&thread, NULL, free_objects, NULL);
+	pthread_join(thread, NULL);
+	for (size_t i = 0; i < OBJECTS; ++i) {
+		entry_arena_alloc(&shared_arena);
+	}
+	size_t after = entry_arena_bytes(&shared_arena);
+	if (after > before + 64 * 1024) {
+		fprintf(stderr, "freed objects weren't reused: %zu bytes of slabs"
+		        " before freeing, %zu after\n", before, after);
+		failed = 1;
+	}
+	entry_arena_destroy(&shared_arena);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}